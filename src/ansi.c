@@ -33,6 +33,9 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "screen.h"
 
@@ -44,6 +47,7 @@
 #include "misc.h"
 #include "process.h"
 #include "resize.h"
+#include "timedlog.h"
 #include "winmsg.h"
 
 /* widths for Z0/Z1 switching */
@@ -58,6 +62,7 @@ char *printcmd = NULL;
 
 uint32_t *blank;		/* line filled with spaces */
 uint32_t *null;			/* line filled with '\0' */
+uint16_t *null16;		/* the same for font and rendition planes */
 
 struct mline mline_old;
 struct mline mline_blank;
@@ -144,9 +149,12 @@ static void MScrollV(Window *, int, int, int, int);
 static void MClearArea(Window *, int, int, int, int, int);
 static void MInsChar(Window *, struct mchar *, int, int);
 static void MPutChar(Window *, struct mchar *, int, int);
+static void MPutStr(Window *, char *, int, int, int);
 static void MWrapChar(Window *, struct mchar *, int, int, int, bool);
 static void MBceLine(Window *, int, int, int, int);
+static void MFreePlanes(Window *, struct mline *);
 static void WChangeSize(Window *, int, int);
+static size_t PrintableRun(Window *, char *, size_t);
 
 void ResetAnsiState(Window *win)
 {
@@ -203,6 +211,46 @@ void SetCharsets(Window *win, char *s)
 
 /*****************************************************************/
 
+/*
+ * Number of bytes at the start of buf that can be put on the current
+ * line as plain ASCII in one go, 0 if the emulator isn't in a state
+ * where every printable byte simply lands at the cursor and advances
+ * it. The run stops before the last column so that wrapping is left
+ * to the state machine.
+ */
+static size_t PrintableRun(Window *win, char *buf, size_t len)
+{
+	size_t n = 0;
+
+	if (win->w_state != LIT || win->w_mbcs || win->w_insert || win->w_ss || win->w_FontL != ASCII)
+		return 0;
+	if (win->w_encoding == UTF8 ? win->w_decodestate != 0 : win->w_encoding != 0)
+		return 0;
+	if (win->w_x >= win->w_width - 1)
+		return 0;
+	if (len > (size_t)(win->w_width - 1 - win->w_x))
+		len = win->w_width - 1 - win->w_x;
+
+#ifdef __SSE2__
+	{
+		const __m128i lo = _mm_set1_epi8(' ' - 1);
+		const __m128i hi = _mm_set1_epi8(0x7f);
+		for (; n + 16 <= len; n += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(buf + n));
+			/* signed compares: bytes >= 0x80 are negative */
+			__m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi));
+			unsigned int mask = _mm_movemask_epi8(ok);
+			if (mask != 0xffff)
+				return n + __builtin_ctz(~mask);
+		}
+	}
+#endif
+	for (; n < len; n++)
+		if ((unsigned char)buf[n] < ' ' || (unsigned char)buf[n] >= 0x7f)
+			break;
+	return n;
+}
+
 /*
  *  Here comes the vt100 emulator
  *  - writes logfiles,
@@ -215,7 +263,11 @@ void WriteString(Window *win, char *buf, size_t len)
 {
 	int c;
 	int font;
+	size_t n;
 	Canvas *cv;
+	int chars[64];		/* UTF-8 decoded ahead of the state machine */
+	uint8_t clens[64];
+	size_t nchars = 0, ci = 0;
 
 	if (len == 0)
 		return;
@@ -230,22 +282,42 @@ void WriteString(Window *win, char *buf, size_t len)
 	}
 
 	if (win->w_width > 0 && win->w_height > 0) {
+		MRendCollect();
 		do {
-			c = (unsigned char)*buf++;
-			if (!win->w_mbcs)
-				win->w_rend.font = win->w_FontL;	/* Default: GL */
-
+			if (nchars && win->w_encoding != UTF8)
+				nchars = ci = 0;	/* switched away, drop what was decoded ahead */
+			if ((n = PrintableRun(win, buf, len)) > 0) {
+				/* shortcut for plain text, same as n rounds through LIT */
+				win->w_rend.font = 0;
+				win->w_rend.mbcs = 0;
+				win->w_rend.image = (unsigned char)buf[n - 1];
+				MPutStr(win, buf, n, win->w_x, win->w_y);
+				LPutStr(&win->w_layer, buf, n, &win->w_rend, win->w_x, win->w_y);
+				win->w_x += n;
+				buf += n;
+				len -= n - 1;
+				/* the run was plain ASCII, one character per byte */
+				if (ci + n <= nchars)
+					ci += n;
+				else
+					nchars = ci = 0;
+				continue;
+			}
 			if (win->w_encoding == UTF8) {
-				c = FromUtf8(c, &win->w_decodestate);
-				if (c == -1)
-					continue;
-				if (c == -2) {
-					c = UCS_REPL;
-					/* try char again */
-					buf--;
-					len++;
+				if (ci == nchars) {
+					ci = 0;
+					FromUtf8Buf(buf, len, &win->w_decodestate, chars, clens, ARRAY_SIZE(chars), &nchars);
+					if (nchars == 0)
+						break;	/* only the start of a sequence is left */
 				}
-			}
+				c = chars[ci];
+				/* a replacement for a broken sequence takes no bytes, the byte is tried again */
+				buf += clens[ci];
+				len = len + 1 - clens[ci++];
+			} else
+				c = (unsigned char)*buf++;
+			if (!win->w_mbcs)
+				win->w_rend.font = win->w_FontL;	/* Default: GL */
 
  tryagain:
 			switch (win->w_state) {
@@ -656,14 +728,29 @@ void WriteString(Window *win, char *buf, size_t len)
 
 static void WLogString(Window *win, char *buf, size_t len)
 {
+	int r;
+
 	if (!win->w_log)
 		return;
-	if (logtstamp_on && win->w_logsilence >= logtstamp_after * 2) {
-		char *t = MakeWinMsg(logtstamp_string, win, '%');
-		logfwrite(win->w_log, t, strlen(t));	/* long time no write */
+	if (win->w_lognonblock && logffull(win->w_log, len)) {
+		/* the logfile can't keep up, don't wait for it */
+		if (!win->w_logdropping)
+			WMsg(win, 0, "Logfile lags behind, output dropped");
+		win->w_logdropping = true;
+		return;
+	}
+	win->w_logdropping = false;
+	if (win->w_log->timed)
+		r = TLogWrite(win, buf, len);	/* the records have the time */
+	else {
+		if (logtstamp_on && win->w_logsilence >= logtstamp_after * 2) {
+			char *t = MakeWinMsg(logtstamp_string, win, '%');
+			logfwrite(win->w_log, t, strlen(t));	/* long time no write */
+		}
+		r = logfwrite(win->w_log, buf, len);
 	}
 	win->w_logsilence = 0;
-	if (logfwrite(win->w_log, buf, len) < 1) {
+	if (r < 1) {
 		WMsg(win, errno, "Error writing logfile");
 		logfclose(win->w_log);
 		win->w_log = NULL;
@@ -1314,7 +1401,7 @@ static int StringEnd(Window *win)
 		}
 		return -1;
 	case DCS:
-		LAY_DISPLAYS(&win->w_layer, AddStr(win->w_string));
+		LAY_DISPLAYS(&win->w_layer, AddStr(win->w_string); ForgetShadow());
 		break;
 	case AKA:
 		if (win->w_title == win->w_akabuf && !*win->w_string)
@@ -1908,38 +1995,37 @@ static void Report(Window *win, char *fmt, int n1, int n2)
 static void MFixLine(Window *win, int y, struct mchar *mc)
 {
 	struct mline *ml = &win->w_mlines[y];
-	if (mc->attr && ml->attr == null) {
-		if ((ml->attr = calloc(win->w_width + 1, 4)) == NULL) {
-			ml->attr = null;
-			mc->attr = win->w_rend.attr = 0;
-			WMsg(win, 0, "Warning: no space for attr - turned off");
-		}
-	}
-	if (mc->font && ml->font == null) {
-		if ((ml->font = calloc(win->w_width + 1, 4)) == NULL) {
-			ml->font = null;
+	if (mc->font && ml->font == null16) {
+		if ((ml->font = sb_getplane(&win->w_sb, win->w_width + 1)) == NULL) {
+			ml->font = null16;
 			win->w_FontL = win->w_charsets[win->w_ss ? win->w_ss : win->w_Charset] = 0;
 			win->w_FontR = win->w_charsets[win->w_ss ? win->w_ss : win->w_CharsetR] = 0;
 			mc->font = win->w_rend.font = 0;
 			WMsg(win, 0, "Warning: no space for font - turned off");
 		}
 	}
-	if (mc->colorbg && ml->colorbg == null) {
-		if ((ml->colorbg = calloc(win->w_width + 1, 4)) == NULL) {
-			ml->colorbg = null;
+	if ((mc->attr || mc->colorbg || mc->colorfg) && ml->rend == null16) {
+		if ((ml->rend = sb_getplane(&win->w_sb, win->w_width + 1)) == NULL) {
+			ml->rend = null16;
+			mc->attr = win->w_rend.attr = 0;
 			mc->colorbg = win->w_rend.colorbg = 0;
-			WMsg(win, 0, "Warning: no space for color background - turned off");
-		}
-	}
-	if (mc->colorfg && ml->colorfg == null) {
-		if ((ml->colorfg = calloc(win->w_width + 1, 4)) == NULL) {
-			ml->colorfg = null;
 			mc->colorfg = win->w_rend.colorfg = 0;
-			WMsg(win, 0, "Warning: no space for color foreground - turned off");
+			WMsg(win, 0, "Warning: no space for attr and color - turned off");
 		}
 	}
 }
 
+/* Clears the attributes of a screen line, the planes are kept for reuse */
+static void MFreePlanes(Window *win, struct mline *ml)
+{
+	if (ml->font != null16)
+		sb_putplane(&win->w_sb, ml->font, win->w_width + 1);
+	ml->font = null16;
+	if (ml->rend != null16)
+		sb_putplane(&win->w_sb, ml->rend, win->w_width + 1);
+	ml->rend = null16;
+}
+
 /*****************************************************************/
 
 #define MKillDwRight(p, ml, x)					\
@@ -2015,18 +2101,7 @@ static void MScrollV(Window *win, int n, int ys, int ye, int bce)
 		for (int i = ys; i < ys + n; i++, ml++) {
 			if (ys == win->w_top)
 				WAddLineToHist(win, ml);
-			if (ml->attr != null)
-				free(ml->attr);
-			ml->attr = null;
-			if (ml->font != null)
-				free(ml->font);
-			ml->font = null;
-			if (ml->colorbg != null)
-				free(ml->colorbg);
-			ml->colorbg = null;
-			if (ml->colorfg != null)
-				free(ml->colorfg);
-			ml->colorfg = null;
+			MFreePlanes(win, ml);
 			memmove(ml->image, blank, (win->w_width + 1) * 4);
 			if (bce)
 				MBceLine(win, i, 0, win->w_width, bce);
@@ -2048,18 +2123,7 @@ static void MScrollV(Window *win, int n, int ys, int ye, int bce)
 		ml = win->w_mlines + ye;
 		/* Clear lines */
 		for (int i = ye; i > ye - n; i--, ml--) {
-			if (ml->attr != null)
-				free(ml->attr);
-			ml->attr = null;
-			if (ml->font != null)
-				free(ml->font);
-			ml->font = null;
-			if (ml->colorbg != null)
-				free(ml->colorbg);
-			ml->colorbg = null;
-			if (ml->colorfg != null)
-				free(ml->colorfg);
-			ml->colorfg = null;
+			MFreePlanes(win, ml);
 			memmove(ml->image, blank, (win->w_width + 1) * 4);
 			if (bce)
 				MBceLine(win, i, 0, win->w_width, bce);
@@ -2167,6 +2231,33 @@ static void MPutChar(Window *win, struct mchar *c, int x, int y)
 	}
 }
 
+/* put n plain ASCII characters with the current rendition at x, y */
+static void MPutStr(Window *win, char *s, int n, int x, int y)
+{
+	struct mline *ml;
+	struct mchar *r = &win->w_rend;
+
+	MFixLine(win, y, r);
+	ml = &win->w_mlines[y];
+	if (ml->font != null16) {
+		/* only lines with fonts can hold double width characters */
+		for (int i = x; i < x + n; i++) {
+			MKillDwRight(win, ml, i);
+			MKillDwLeft(win, ml, i);
+		}
+	}
+	for (int i = 0; i < n; i++)
+		ml->image[x + i] = (unsigned char)s[i];
+	if (ml->font != null16)
+		for (int i = x; i < x + n; i++)
+			ml->font[i] = r->font;
+	if (ml->rend != null16) {
+		uint16_t rend = mrend_index(r);
+		for (int i = x; i < x + n; i++)
+			ml->rend[i] = rend;
+	}
+}
+
 static void MWrapChar(Window *win, struct mchar *c, int y, int top, int bot, bool ins)
 {
 	struct mline *ml;
@@ -2195,58 +2286,38 @@ static void MBceLine(Window *win, int y, int xs, int xe, int bce)
 	mc.colorbg = bce;
 	MFixLine(win, y, &mc);
 	ml = win->w_mlines + y;
-	if (mc.attr)
-		for (int x = xs; x <= xe; x++)
-			ml->attr[x] = mc.attr;
-	if (mc.colorbg)
-		for (int x = xs; x <= xe; x++)
-			ml->colorbg[x] = mc.colorbg;
-	if (mc.colorfg)
+	if (ml->rend != null16) {
+		uint16_t rend = mrend_index(&mc);
 		for (int x = xs; x <= xe; x++)
-			ml->colorfg[x] = mc.colorfg;
+			ml->rend[x] = rend;
+	}
 }
 
 static void WAddLineToHist(Window *win, struct mline *ml)
 {
-	uint32_t *q, *o;
+	uint32_t *q;
 	struct mline *hml;
 
 	if (win->w_histheight == 0)
 		return;
+	sb_reuse(win, win->w_histidx);
 	hml = &win->w_hlines[win->w_histidx];
 	q = ml->image;
 	ml->image = hml->image;
 	hml->image = q;
 
-	q = ml->attr;
-	o = hml->attr;
-	hml->attr = q;
-	ml->attr = null;
-	if (o != null)
-		free(o);
-	q = ml->font;
-	o = hml->font;
-	hml->font = q;
-	ml->font = null;
-	if (o != null)
-		free(o);
-	q = ml->colorbg;
-	o = hml->colorbg;
-	hml->colorbg = q;
-	ml->colorbg = null;
-	if (o != null)
-		free(o);
-	q = ml->colorfg;
-	o = hml->colorfg;
-	hml->colorfg = q;
-	ml->colorfg = null;
-	if (o != null)
-		free(o);
+	/* the oldest line drops out, the new one gets interned planes */
+	sb_release(&win->w_sb, hml);
+	hml->font = ml->font;
+	hml->rend = ml->rend;
+	ml->font = ml->rend = null16;
+	sb_freeze(&win->w_sb, hml, win->w_width + 1);
 
 	if (++win->w_histidx >= win->w_histheight)
 		win->w_histidx = 0;
 	if (win->w_scrollback_height < win->w_histheight)
 		++win->w_scrollback_height;
+	sb_pack(win);
 }
 
 int MFindUsedLine(Window *win, int ye, int ys)
@@ -2257,14 +2328,10 @@ int MFindUsedLine(Window *win, int ye, int ys)
 	for (y = ye; y >= ys; y--, ml--) {
 		if (memcmp(ml->image, blank, win->w_width * 4))
 			break;
-		if (ml->attr != null && memcmp(ml->attr, null, win->w_width * 4))
-			break;
-		if (ml->colorbg != null && memcmp(ml->colorbg, null, win->w_width * 4))
-			break;
-		if (ml->colorfg != null && memcmp(ml->colorfg, null, win->w_width * 4))
+		if (ml->rend != null16 && memcmp(ml->rend, null16, win->w_width * 2))
 			break;
 		if (win->w_encoding == UTF8) {
-			if (ml->font != null && memcmp(ml->font, null, win->w_width))
+			if (ml->font != null16 && memcmp(ml->font, null16, win->w_width * 2))
 				break;
 		}
 	}
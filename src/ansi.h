@@ -172,6 +172,7 @@ extern char *printcmd;
 
 extern uint32_t *blank;
 extern uint32_t *null;
+extern uint16_t *null16;
 
 extern uint64_t renditions[];
 
@@ -71,6 +71,7 @@ struct comm comms[RC_LAST + 1] =
   { "colon",		NEED_LAYER|ARGS_01,		{NULL} },
   { "command",		NEED_DISPLAY|ARGS_02,		{NULL} },
   { "compacthist",	ARGS_01,			{NULL} },
+  { "compresshist",	ARGS_01,			{NULL} },
   { "console",		NEED_FORE|ARGS_01,		{NULL} },
   { "copy",		NEED_FORE|NEED_DISPLAY|ARGS_0,	{NULL} },
   { "crlf",		ARGS_01,			{NULL} },
@@ -90,6 +91,7 @@ struct comm comms[RC_LAST + 1] =
 #if defined(ENABLE_UTMP)
   { "deflogin",		ARGS_1,				{NULL} },
 #endif
+  { "deflognonblock",	ARGS_1,				{NULL} },
   { "defmode",		ARGS_1,				{NULL} },
   { "defmonitor",	ARGS_1,				{NULL} },
   { "defmousetrack",	ARGS_1,				{NULL} },
@@ -105,6 +107,7 @@ struct comm comms[RC_LAST + 1] =
   { "detach",		NEED_DISPLAY|ARGS_01,		{NULL} },
   { "digraph",		NEED_LAYER|ARGS_012,		{NULL} },
   { "dinfo",		NEED_DISPLAY|ARGS_0,		{NULL} },
+  { "displayfps",	ARGS_01,			{NULL} },
   { "displays",		NEED_LAYER|ARGS_0,		{NULL} },
   { "dumptermcap",	NEED_FORE|ARGS_0,		{NULL} },
   { "dynamictitle",	ARGS_1,				{NULL} },
@@ -141,6 +144,8 @@ struct comm comms[RC_LAST + 1] =
 #if defined(ENABLE_UTMP)
   { "login",		NEED_FORE|ARGS_01,		{NULL} },
 #endif
+  { "lognonblock",	NEED_FORE|ARGS_01,		{NULL} },
+  { "logrotate",	ARGS_012,			{NULL} },
   { "logtstamp",	ARGS_012,			{NULL} },
   { "mapdefault",	NEED_DISPLAY|ARGS_0,		{NULL} },
   { "mapnotnext",	NEED_DISPLAY|ARGS_0,		{NULL} },
@@ -161,6 +166,7 @@ struct comm comms[RC_LAST + 1] =
   { "other",		ARGS_0,				{NULL} },
   { "parent",		ARGS_0,				{NULL} },
   { "partial",		NEED_FORE|ARGS_01,		{NULL} },
+  { "passthrough",	ARGS_01,			{NULL} },
   { "paste",		NEED_LAYER|ARGS_012,		{NULL} },
   { "pastefont",	ARGS_01,			{NULL} },
   { "pow_break",	NEED_FORE|ARGS_01,		{NULL} },
@@ -35,6 +35,7 @@
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -72,6 +73,16 @@ static void disp_idle_fn(Event *, void *);
 static void disp_blanker_fn(Event *, void *);
 static void disp_processinput (Display *, unsigned char *, size_t);
 static void WriteLP(int, int);
+static int SkipSameCells(struct mline *, struct mline *, int, int);
+static Window *HashableWindow(void);
+static void ScrollToWindow(void);
+static void FreeShadow(void);
+static void ShadowLost(int, int, int);
+static void ShadowClear(int, int, int, int);
+static void ShadowShift(int, int, int, int);
+static void ShadowScroll(int, int, int, int);
+static void ShadowChar(uint32_t);
+static int BlankTail(struct mline *, struct mline *, int, int);
 static void INSERTCHAR(uint32_t);
 static void RAW_PUTCHAR(uint32_t);
 static void SetBackColor(int);
@@ -218,7 +229,6 @@ Display *MakeDisplay(char *uname, char *utty, char *term, int fd, pid_t pid, str
 	D_obufmax = defobuflimit;
 	D_obuflenmax = D_obuflen - D_obufmax;
 	D_auto_nuke = defautonuke;
-	D_obufp = D_obuf;
 	D_printfd = -1;
 	D_userpid = pid;
 	strncpy(D_usertty, utty, ARRAY_SIZE(D_usertty) - 1);
@@ -279,6 +289,8 @@ void FreeDisplay(void)
 		free(D_status_lastmsg);
 	if (D_obuf)
 		free(D_obuf);
+	free(D_mvcost);
+	FreeShadow();
 	*dp = display->d_next;
 
 	while (D_canvas.c_slperp)
@@ -290,8 +302,10 @@ void FreeDisplay(void)
 			p->w_pdisplay = NULL;
 		if (p->w_lastdisp == display)
 			p->w_lastdisp = NULL;
-		if (p->w_readev.condneg == (int *)&D_status || p->w_readev.condneg == &D_obuflenmax)
+		if (p->w_readev.condneg == (int *)&D_status || p->w_readev.condneg == &D_obuflenmax) {
 			p->w_readev.condpos = p->w_readev.condneg = NULL;
+			evgate(&p->w_readev);
+		}
 	}
 	for (Window *p = mru_window; p; p = p->w_prev_mru)
 		if (p->w_zdisplay == display)
@@ -311,6 +325,7 @@ void FreeDisplay(void)
  */
 void InitTerm(int adapt)
 {
+	ForgetShadow();
 	D_top = D_bot = -1;
 	AddCStr(D_IS);
 	AddCStr(D_TI);
@@ -366,6 +381,7 @@ void FinitTerm(void)
 		AddChar('\n');
 		AddCStr(D_TE);
 	}
+	ForgetShadow();
 	Flush(3);
 }
 
@@ -377,6 +393,7 @@ static void INSERTCHAR(uint32_t c)
 				AddCStr(D_IC);
 			else
 				AddCStr2(D_CIC, 1);
+			ShadowShift(D_y, D_x, -1, 0);
 			RAW_PUTCHAR(c);
 			return;
 		}
@@ -430,7 +447,8 @@ void PUTCHARLP(uint32_t c)
 
 static void RAW_PUTCHAR(uint32_t c)
 {
-
+	if (D_shadow)
+		ShadowChar(c);
 	if (D_encoding == UTF8) {
 		if (D_mbcs) {
 			c = D_mbcs;
@@ -671,6 +689,44 @@ int CalcCost(char *s)
 		return EXPENSIVE;
 }
 
+/*
+ * The costs of the parametrized moves only depend on the display and the
+ * target position or distance, so GotoPos() does not need to run tgoto()
+ * and tputs() for every candidate. D_mvcost holds the CM cost of every
+ * position, followed by the CRI and CLE costs per column distance and
+ * the CDO and CUP costs per line distance. 0 means not known yet, idx -1
+ * that the move is outside of the display and not memoized.
+ */
+#define MV_CM(x, y)	((y) * D_mvwidth + (x))
+#define MV_CRI(n)	(D_mvwidth * D_mvheight + (n))
+#define MV_CLE(n)	(MV_CRI(D_mvwidth) + (n))
+#define MV_CDO(n)	(MV_CLE(D_mvwidth) + (n))
+#define MV_CUP(n)	(MV_CDO(D_mvheight) + (n))
+#define MV_SIZE		MV_CUP(D_mvheight)
+
+static int MoveCost(int idx, char *cap, int p1, int p2)
+{
+	int cost;
+
+	if (idx < 0)
+		return CalcCost(tgoto(cap, p1, p2));
+	if (D_mvcost && (D_mvwidth != D_width || D_mvheight != D_height)) {
+		free(D_mvcost);
+		D_mvcost = NULL;
+	}
+	if (!D_mvcost) {
+		D_mvwidth = D_width;
+		D_mvheight = D_height;
+		D_mvcost = calloc(MV_SIZE, sizeof(short));
+	}
+	if (D_mvcost && D_mvcost[idx])
+		return D_mvcost[idx];
+	cost = CalcCost(tgoto(cap, p1, p2));
+	if (D_mvcost)
+		D_mvcost[idx] = cost;
+	return cost;
+}
+
 void GotoPos(int x2, int y2)
 {
 	int dy, dx, x1, y1;
@@ -678,6 +734,7 @@ void GotoPos(int x2, int y2)
 	int m;
 	char *s;
 	int CMcost;
+	bool memo;
 	enum move_t xm = M_NONE, ym = M_NONE;
 
 	if (!display)
@@ -719,19 +776,21 @@ void GotoPos(int x2, int y2)
 	if ((y1 > D_bot && y2 > y1) || (y1 < D_top && y2 < y1))
 		goto DoCM;
 
+	/* only moves within the display have memoized costs */
+	memo = x1 < D_width && x2 >= 0 && x2 < D_width && y1 < D_height && y2 >= 0 && y2 < D_height;
+
 	/* Calculate CMcost */
 	if (D_HO && !x2 && !y2)
-		s = D_HO;
+		CMcost = CalcCost(D_HO);
 	else
-		s = tgoto(D_CM, x2, y2);
-	CMcost = CalcCost(s);
+		CMcost = MoveCost(memo ? MV_CM(x2, y2) : -1, D_CM, x2, y2);
 
 	/* Calculate the cost to move the cursor to the right x position */
 	costx = EXPENSIVE;
 	if (x1 >= 0) {		/* relativ x positioning only if we know where we are */
 		if (dx > 0) {
 			if (D_CRI && (dx > 1 || !D_ND)) {
-				costx = CalcCost(tgoto(D_CRI, 0, dx));
+				costx = MoveCost(memo ? MV_CRI(dx) : -1, D_CRI, 0, dx);
 				xm = M_CRI;
 			}
 			if ((m = D_NDcost * dx) < costx) {
@@ -740,7 +799,7 @@ void GotoPos(int x2, int y2)
 			}
 		} else if (dx < 0) {
 			if (D_CLE && (dx < -1 || !D_BC)) {
-				costx = CalcCost(tgoto(D_CLE, 0, -dx));
+				costx = MoveCost(memo ? MV_CLE(-dx) : -1, D_CLE, 0, -dx);
 				xm = M_CLE;
 			}
 			if ((m = -dx * D_LEcost) < costx) {
@@ -763,7 +822,7 @@ void GotoPos(int x2, int y2)
 	costy = EXPENSIVE;
 	if (dy > 0) {
 		if (D_CDO && dy > 1) {	/* DO & NL are always != 0 */
-			costy = CalcCost(tgoto(D_CDO, 0, dy));
+			costy = MoveCost(memo ? MV_CDO(dy) : -1, D_CDO, 0, dy);
 			ym = M_CDO;
 		}
 		if ((m = dy * ((x2 == 0) ? D_NLcost : D_DOcost)) < costy) {
@@ -772,7 +831,7 @@ void GotoPos(int x2, int y2)
 		}
 	} else if (dy < 0) {
 		if (D_CUP && (dy < -1 || !D_UP)) {
-			costy = CalcCost(tgoto(D_CUP, 0, -dy));
+			costy = MoveCost(memo ? MV_CUP(-dy) : -1, D_CUP, 0, -dy);
 			ym = M_CUP;
 		}
 		if ((m = -dy * D_UPcost) < costy) {
@@ -867,6 +926,8 @@ void ClearArea(int x1, int y1, int xs, int xe, int x2, int y2, int bce, int usel
 		if (x1 == 0 && y1 == 0 && D_CL) {
 			AddCStr(D_CL);
 			D_y = D_x = 0;
+			for (int y = 0; y < D_height; y++)
+				ShadowClear(y, 0, D_width - 1, bce);
 			return;
 		}
 		/*
@@ -876,12 +937,16 @@ void ClearArea(int x1, int y1, int xs, int xe, int x2, int y2, int bce, int usel
 		if (D_CD && (y1 < y2 || !D_CE)) {
 			GotoPos(x1, y1);
 			AddCStr(D_CD);
+			ShadowClear(y1, x1, D_width - 1, bce);
+			for (int y = y1 + 1; y < D_height; y++)
+				ShadowClear(y, 0, D_width - 1, bce);
 			return;
 		}
 	}
 	if (x1 == 0 && xs == 0 && (xe == D_width - 1 || y1 == y2) && y1 == 0 && D_CCD && (!bce || D_BE)) {
 		GotoPos(x1, y1);
 		AddCStr(D_CCD);
+		ForgetShadow();
 		return;
 	}
 	xxe = xe;
@@ -891,11 +956,13 @@ void ClearArea(int x1, int y1, int xs, int xe, int x2, int y2, int bce, int usel
 		if (x1 == 0 && D_CB && (xxe != D_width - 1 || (D_x == xxe && D_y == y)) && (!bce || D_BE)) {
 			GotoPos(xxe, y);
 			AddCStr(D_CB);
+			ShadowClear(y, 0, xxe, bce);
 			continue;
 		}
 		if (xxe == D_width - 1 && D_CE && (!bce || D_BE)) {
 			GotoPos(x1, y);
 			AddCStr(D_CE);
+			ShadowClear(y, x1, xxe, bce);
 			continue;
 		}
 		if (uselayfn) {
@@ -930,12 +997,476 @@ void ClearArea(int x1, int y1, int xs, int xe, int x2, int y2, int bce, int usel
 	}
 }
 
+/*
+ * Displays showing the same layer through the same kind of terminal are
+ * often in exactly the same state; then an update turns into the same
+ * bytes for all of them. The layer code records the bytes and the
+ * resulting state for the first display with FanoutBegin()/FanoutEnd()
+ * and FanoutReplay() appends them to the others, which saves redoing the
+ * motion, rendition and encoding work for every observer.
+ */
+struct outstate {
+	uint32_t tcsum;
+	int width, height, top, bot, x, y;
+	struct mchar rend, lpchar;
+	char atyp;
+	int mbcs, encoding, realfont, lp_missing;
+	bool insert, shadow;
+};
+
+static struct {
+	bool valid;
+	bool recording;
+	bool dirty;		/* the shadow changed beyond the cells put */
+	int sx1, sx2, sy;	/* shadow cells the recording wrote */
+	const void *key;	/* what was put */
+	int xs, xe, y;		/* where it was put */
+	Display *d;		/* display it was recorded from */
+	int used;		/* ObufUsed() when recording started */
+	struct outstate before, after;
+	char *buf;
+	int len, size;
+} fanout;
+
+static void GetOutState(struct outstate *s)
+{
+	s->tcsum = D_tcsum;
+	s->width = D_width;
+	s->height = D_height;
+	s->top = D_top;
+	s->bot = D_bot;
+	s->x = D_x;
+	s->y = D_y;
+	s->rend = D_rend;
+	s->lpchar = D_lpchar;
+	s->atyp = D_atyp;
+	s->mbcs = D_mbcs;
+	s->encoding = D_encoding;
+	s->realfont = D_realfont;
+	s->lp_missing = D_lp_missing;
+	s->insert = D_insert;
+	s->shadow = D_shadow != NULL;
+}
+
+static bool SameMchar(struct mchar *a, struct mchar *b)
+{
+	return cmp_mchar(a, b) && a->colorfg == b->colorfg && a->mbcs == b->mbcs;
+}
+
+static bool SameOutState(struct outstate *a, struct outstate *b)
+{
+	return a->tcsum == b->tcsum && a->width == b->width && a->height == b->height
+	    && a->top == b->top && a->bot == b->bot && a->x == b->x && a->y == b->y
+	    && SameMchar(&a->rend, &b->rend) && SameMchar(&a->lpchar, &b->lpchar)
+	    && a->atyp == b->atyp && a->mbcs == b->mbcs && a->encoding == b->encoding
+	    && a->realfont == b->realfont && a->lp_missing == b->lp_missing
+	    && a->insert == b->insert && a->shadow == b->shadow;
+}
+
+/* Forgets the last recording, called for every new update */
+void FanoutReset(void)
+{
+	fanout.valid = false;
+}
+
+/* Starts recording an update, unless there is a recording to replay */
+void FanoutBegin(void)
+{
+	if (fanout.valid || D_status || !D_tcinited)
+		return;
+	fanout.recording = true;
+	GetOutState(&fanout.before);
+	fanout.used = ObufUsed();
+	fanout.dirty = false;
+	fanout.sx1 = D_width;
+	fanout.sx2 = fanout.sy = -1;
+	fanout.d = display;
+}
+
+/* Keeps the bytes the update of cells xs to xe of line y produced */
+void FanoutEnd(const void *key, int xs, int xe, int y)
+{
+	char *p;
+	int n;
+
+	if (!fanout.recording)
+		return;
+	fanout.recording = false;
+	if (fanout.dirty || D_status)
+		return;
+	if ((n = ObufUsed() - fanout.used) < 0)
+		return;
+	if (n > fanout.size) {
+		char *buf = realloc(fanout.buf, n);
+
+		if (!buf)
+			return;
+		fanout.buf = buf;
+		fanout.size = n;
+	}
+	/* the bytes are the last n of the ring */
+	if ((p = D_obufp - n) < D_obuf)
+		p += D_obufend - D_obuf;
+	for (int i = 0; i < n; i++) {
+		fanout.buf[i] = *p++;
+		if (p == D_obufend)
+			p = D_obuf;
+	}
+	fanout.len = n;
+	GetOutState(&fanout.after);
+	fanout.key = key;
+	fanout.xs = xs;
+	fanout.xe = xe;
+	fanout.y = y;
+	fanout.valid = true;
+}
+
+/*
+ * Brings the display up to date with the recorded bytes if it was in the
+ * same state as the recorded one, returns false if it has to do the
+ * update itself.
+ */
+bool FanoutReplay(const void *key, int xs, int xe, int y)
+{
+	struct outstate now;
+	Display *d = fanout.d;
+
+	if (!fanout.valid || fanout.key != key || fanout.xs != xs || fanout.xe != xe || fanout.y != y)
+		return false;
+	if (display == d || D_status || !D_tcinited)
+		return false;
+	GetOutState(&now);
+	if (!SameOutState(&now, &fanout.before))
+		return false;
+	for (int i = 0; i < fanout.len; i++)
+		AddChar(fanout.buf[i]);
+	D_x = fanout.after.x;
+	D_y = fanout.after.y;
+	D_rend = fanout.after.rend;
+	D_lpchar = fanout.after.lpchar;
+	D_atyp = fanout.after.atyp;
+	D_mbcs = fanout.after.mbcs;
+	D_realfont = fanout.after.realfont;
+	D_lp_missing = fanout.after.lp_missing;
+	D_insert = fanout.after.insert;
+	if (D_shadow && fanout.sy >= 0) {
+		struct mline *from = &d->d_shadow[fanout.sy], *to = &D_shadow[fanout.sy];
+		int x = fanout.sx1, n = fanout.sx2 - fanout.sx1 + 1;
+
+		memcpy(to->image + x, from->image + x, n * 4);
+		memcpy(to->font + x, from->font + x, n * 2);
+		memcpy(to->rend + x, from->rend + x, n * 2);
+	}
+	return true;
+}
+
+/*
+ * The shadow screen holds the cells we have sent to the terminal, so
+ * that refreshing only has to send what differs from it. Cells we
+ * cannot vouch for hold SHADOW_UNKNOWN, which matches no real cell;
+ * D_shadowok marks the lines without any of them.
+ */
+#define SHADOW_UNKNOWN	0xffffffff
+
+static void FreeShadow(void)
+{
+	for (int y = 0; D_shadow && y < D_shheight; y++)
+		free(D_shadow[y].image);
+	free(D_shadow);
+	free(D_shadowok);
+	D_shadow = NULL;
+	D_shadowok = NULL;
+	D_shwidth = D_shheight = 0;
+}
+
+/* Marks all of the shadow as unknown, resizing it if needed */
+void ForgetShadow(void)
+{
+	fanout.dirty = true;
+	if (!display)
+		return;
+	if (D_shwidth != D_width || D_shheight != D_height) {
+		FreeShadow();
+		if (D_width <= 0 || D_height <= 0)
+			return;
+		D_shadow = calloc(D_height, sizeof(struct mline));
+		D_shadowok = malloc(D_height);
+		if (!D_shadow || !D_shadowok) {
+			FreeShadow();
+			return;
+		}
+		D_shwidth = D_width;
+		D_shheight = D_height;
+		for (int y = 0; y < D_height; y++) {
+			/* one block per line, so that lines can be swapped */
+			char *p = calloc(D_width + 1, 4 + 2 + 2);
+
+			if (!p) {
+				FreeShadow();
+				return;
+			}
+			D_shadow[y].image = (uint32_t *)p;
+			D_shadow[y].font = (uint16_t *)(p + (D_width + 1) * 4);
+			D_shadow[y].rend = D_shadow[y].font + D_width + 1;
+		}
+	}
+	for (int y = 0; y < D_shheight; y++) {
+		memset(D_shadow[y].image, 0xff, D_shwidth * 4);
+		D_shadowok[y] = 0;
+	}
+}
+
+static void ShadowLost(int y, int x1, int x2)
+{
+	fanout.dirty = true;
+	if (!D_shadow || y < 0 || y >= D_shheight)
+		return;
+	if (x1 < 0)
+		x1 = 0;
+	for (; x1 <= x2 && x1 < D_shwidth; x1++)
+		D_shadow[y].image[x1] = SHADOW_UNKNOWN;
+	D_shadowok[y] = 0;
+}
+
+/* Notes that the terminal erased the cells, with background color bce */
+static void ShadowClear(int y, int x1, int x2, int bce)
+{
+	struct mline *ml;
+	uint16_t r;
+
+	fanout.dirty = true;
+	if (!D_shadow || y < 0 || y >= D_shheight)
+		return;
+	r = bce ? MRendIndex(0, bce, 0) : 0;
+	if (bce && !r) {
+		ShadowLost(y, x1, x2);
+		return;
+	}
+	if (x1 < 0)
+		x1 = 0;
+	if (x2 >= D_shwidth)
+		x2 = D_shwidth - 1;
+	ml = &D_shadow[y];
+	for (int x = x1; x <= x2; x++) {
+		ml->image[x] = ' ';
+		ml->font[x] = 0;
+		ml->rend[x] = r;
+	}
+	if (x1 == 0 && x2 == D_shwidth - 1)
+		D_shadowok[y] = 1;
+}
+
+/* Deletes n cells at x, or inserts -n blank ones if n is negative */
+static void ShadowShift(int y, int x, int n, int bce)
+{
+	struct mline *ml;
+	int w = D_shwidth;
+
+	if (!D_shadow)
+		return;
+	if (x < 0 || y < 0 || x >= w || y >= D_shheight) {
+		ForgetShadow();
+		return;
+	}
+	ml = &D_shadow[y];
+	if (n > 0) {
+		if (n > w - x)
+			n = w - x;
+		copy_mline(ml, x + n, x, w - x - n);
+		ShadowClear(y, w - n, w - 1, bce);
+	} else if (n < 0) {
+		n = -n;
+		if (n > w - x)
+			n = w - x;
+		copy_mline(ml, x, x + n, w - x - n);
+		ShadowClear(y, x, x + n - 1, bce);
+	}
+}
+
+/* Scrolls lines ys to ye up by n lines, or down if n is negative */
+static void ShadowScroll(int ys, int ye, int n, int bce)
+{
+	struct mline ml;
+	char ok;
+
+	if (!D_shadow)
+		return;
+	if (ys < 0 || ye >= D_shheight || ys > ye) {
+		ForgetShadow();
+		return;
+	}
+	for (; n > 0; n--) {
+		ml = D_shadow[ys];
+		ok = D_shadowok[ys];
+		memmove(D_shadow + ys, D_shadow + ys + 1, (ye - ys) * sizeof(struct mline));
+		memmove(D_shadowok + ys, D_shadowok + ys + 1, ye - ys);
+		D_shadow[ye] = ml;
+		D_shadowok[ye] = ok;
+		ShadowClear(ye, 0, D_shwidth - 1, bce);
+	}
+	for (; n < 0; n++) {
+		ml = D_shadow[ye];
+		ok = D_shadowok[ye];
+		memmove(D_shadow + ys + 1, D_shadow + ys, (ye - ys) * sizeof(struct mline));
+		memmove(D_shadowok + ys + 1, D_shadowok + ys, ye - ys);
+		D_shadow[ys] = ml;
+		D_shadowok[ys] = ok;
+		ShadowClear(ys, 0, D_shwidth - 1, bce);
+	}
+}
+
+/* Notes a character RAW_PUTCHAR() is about to send */
+static void ShadowChar(uint32_t c)
+{
+	int x = D_x, y = D_y;
+	struct mline *ml;
+	uint16_t r;
+
+	if (x < 0 || y < 0 || x >= D_shwidth || y >= D_shheight) {
+		ForgetShadow();
+		return;
+	}
+	if (D_insert)
+		ShadowShift(y, x, -1, 0);
+	if (D_mbcs || (D_encoding == UTF8 ? utf8_isdouble(c) : is_dw_font(D_rend.font))) {
+		/* double width characters are not followed */
+		ShadowLost(y, 0, D_shwidth - 1);
+		return;
+	}
+	r = mrend_index(&D_rend);
+	if (!r && (D_rend.attr | D_rend.colorbg | D_rend.colorfg)) {
+		ShadowLost(y, x, x);
+		return;
+	}
+	ml = &D_shadow[y];
+	ml->image[x] = c;
+	ml->font[x] = D_rend.font;
+	ml->rend[x] = r;
+	if (fanout.recording) {
+		if (fanout.sy < 0)
+			fanout.sy = y;
+		else if (fanout.sy != y)
+			fanout.dirty = true;
+		if (x < fanout.sx1)
+			fanout.sx1 = x;
+		if (x > fanout.sx2)
+			fanout.sx2 = x;
+	}
+	if (x == D_width - 1 && y == D_bot && D_AM && !D_CLP)
+		ShadowScroll(D_top, D_bot, 1, D_BE ? D_rend.colorbg : 0);	/* the terminal wraps and scrolls */
+}
+
+/*
+ * Line hashes let Redisplay() find out how far the window scrolled
+ * since the terminal was last updated, e.g. while the display was
+ * blocked. The lines the shadow screen holds are moved with ScrollV()
+ * so that DisplayLine() only has to draw what differs. This only works
+ * for a single canvas showing a window over the full width.
+ */
+static Window *HashableWindow(void)
+{
+	Canvas *cv = D_cvlist;
+	Window *win;
+
+	if (!cv || cv->c_next || cv->c_xs != 0 || cv->c_xe != D_width - 1)
+		return NULL;
+	if (cv->c_layer->l_layfn != &WinLf || !cv->c_vplist || cv->c_vplist->v_next)
+		return NULL;
+	win = cv->c_layer->l_data;
+	if (win->w_width != D_width || win->w_height != cv->c_ye - cv->c_ys + 1)
+		return NULL;
+	if (cv->c_vplist->v_xoff != 0 || cv->c_vplist->v_yoff != cv->c_ys)
+		return NULL;
+	return win;
+}
+
+static uint32_t LineHash(struct mline *ml, int w)
+{
+	uint32_t h = 2166136261u;
+
+	for (int x = 0; x < w; x++) {
+		h = (h ^ ml->image[x]) * 16777619;
+		h = (h ^ ((uint32_t)ml->font[x] << 16 | ml->rend[x])) * 16777619;
+	}
+	return h ? h : 1;	/* 0: unknown */
+}
+
+/* rough number of bytes it takes to draw a line from scratch */
+static int LineCost(struct mline *ml, int w)
+{
+	while (w > 0 && ml->image[w - 1] == ' ' && !ml->font[w - 1] && !ml->rend[w - 1])
+		w--;
+	return w;
+}
+
+/* rough number of bytes ScrollV() sends to scroll the lines ys..ye by n */
+static int ScrollCost(int ys, int ye, int n)
+{
+	int cost, line;
+
+	cost = CalcCost(tgoto(D_CM, 0, ys));
+	if (D_CS && (D_top != ys || D_bot != ye))
+		cost += CalcCost(tgoto(D_CS, ye, ys)) + CalcCost(tgoto(D_CS, D_height - 1, 0));
+	line = CalcCost(n > 0 ? D_NL : D_SR);
+	if (D_DL && D_AL && CalcCost(D_DL) + CalcCost(D_AL) < line)
+		line = CalcCost(D_DL) + CalcCost(D_AL);
+	return cost + (n < 0 ? -n : n) * line;
+}
+
+static void ScrollToWindow(void)
+{
+	Window *win = HashableWindow();
+	uint32_t *old, *new;
+	int ys, ye, h;
+	int best = 0, bestn = -1;
+	int gain = 0;
+
+	if (!win || !D_shadow || D_shwidth != D_width)
+		return;
+	ys = D_cvlist->c_ys;
+	ye = D_cvlist->c_ye;
+	h = ye - ys + 1;
+	if (!(old = calloc(2 * h, sizeof(uint32_t))))
+		return;
+	new = old + h;
+	for (int y = 0; y < h; y++) {
+		if (D_shadowok[ys + y])
+			old[y] = LineHash(&D_shadow[ys + y], D_width);
+		new[y] = LineHash(&win->w_mlines[y], D_width);
+	}
+
+	/* vote for the scroll distance keeping most lines in place */
+	for (int n = -(h - 1); n < h; n++) {
+		int same = 0;
+
+		for (int y = 0; y < h; y++)
+			if (y + n >= 0 && y + n < h && old[y + n] == new[y])
+				same++;
+		if (same > bestn || (same == bestn && n == 0)) {
+			best = n;
+			bestn = same;
+		}
+	}
+	/* only worth it if the lines it keeps cost more than scrolling */
+	for (int y = 0; best && y < h; y++) {
+		bool kept = y + best >= 0 && y + best < h && old[y + best] == new[y];
+
+		if (kept != (old[y] == new[y]))
+			gain += (kept ? 1 : -1) * LineCost(&win->w_mlines[y], D_width);
+	}
+	if (best && gain > ScrollCost(ys, ye, best))
+		ScrollV(0, ys, D_width - 1, ye, best, 0);
+	free(old);
+}
+
 /*
  * if cur_only > 0, we only redisplay current line, as a full refresh is
  * too expensive over a low baud line.
  */
 void Redisplay(int cur_only)
 {
+	if (cur_only < 0)
+		ForgetShadow();	/* the user asked for it, draw everything */
 	/* XXX do em all? */
 	InsertMode(false);
 	ChangeScrollRegion(0, D_height - 1);
@@ -949,12 +1480,15 @@ void Redisplay(int cur_only)
 	SetRendition(&mchar_null);
 	SetFlow(FLOW_ON);
 
-	ClearAll();
+	if (cur_only > 0 || !D_shadow)
+		ClearAll();
+	else
+		ScrollToWindow();
 	RefreshXtermOSC();
 	if (cur_only > 0 && D_fore)
 		RefreshArea(0, D_fore->w_y, D_width - 1, D_fore->w_y, 1);
 	else
-		RefreshAll(1);
+		RefreshAll(!D_shadow);
 	RefreshHStatus();
 	CV_CALL(D_forecv, LayRestore();
 		LaySetCursor());
@@ -998,15 +1532,18 @@ void ScrollH(int y, int xs, int xe, int n, int bce, struct mline *oml)
 			/* UpdateLine(oml, y, xs, xe); */
 			return;
 		}
+		ShadowShift(y, xs, n, D_BE ? bce : 0);
 	} else {
 		if (-n >= xe - xs + 1)
 			n = -(xe - xs + 1);
 		if (!D_insert) {
-			if (D_CIC && !(n == -1 && D_IC))
+			if (D_CIC && !(n == -1 && D_IC)) {
 				AddCStr2(D_CIC, -n);
-			else if (D_IC) {
+				ShadowShift(y, xs, n, D_BE ? bce : 0);
+			} else if (D_IC) {
 				for (int i = -n; i--;)
 					AddCStr(D_IC);
+				ShadowShift(y, xs, n, D_BE ? bce : 0);
 			} else if (D_IM) {
 				InsertMode(true);
 				SetRendition(&mchar_null);
@@ -1137,6 +1674,7 @@ void ScrollV(int xs, int ys, int xe, int ye, int n, int bce)
 		RefreshArea(xs, ys, xe, ye, 0);
 		return;
 	}
+	ShadowScroll(ys, ye, up ? n : -n, D_BE ? bce : 0);
 	if (bce && !D_BE) {
 		if (up)
 			ClearArea(xs, ye - n + 1, xs, xe, xe, ye, bce, 0);
@@ -1397,29 +1935,152 @@ static void SetBackColor(int new)
 	SetColor(D_rend.colorfg, new);
 }
 
+/* parameters switching SGR 1-9 off again */
+static const unsigned char sgroff[10] = { 0, 22, 22, 23, 24, 25, 25, 27, 28, 29 };
+
+/* Appends the SGR parameter SetColor() would send for color c */
+static char *SGRColor(char *p, uint32_t c, bool bg)
+{
+	if (c == 0)
+		return p + sprintf(p, ";%d", bg ? 49 : 39);
+	if (c & 0x01000000) {
+		c &= 0x0f;
+		if (c < 8)
+			return p + sprintf(p, ";%d", (bg ? 40 : 30) + c);
+		if (D_CXT)
+			return p + sprintf(p, ";%d", (bg ? 100 : 90) + (c & 7));
+	} else if (c & 0x02000000) {
+		c &= 0xff;
+		if (c > 15 && D_CCO != 256)
+			c = D_CCO == 88 ? color256to88(c) : color256to16(c);
+		return p + sprintf(p, ";%d;5;%d", bg ? 48 : 38, c);
+	} else if ((c & 0x04000000) && hastruecolor)
+		return p + sprintf(p, ";%d;2;%d;%d;%d", bg ? 48 : 38,
+				   (c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+	return p;
+}
+
+/* Appends the SGR parameters switching on the attributes in attr */
+static char *SGRAttr(char *p, int attr)
+{
+	uint32_t sent = 0;	/* parameters 0-31 already in the sequence */
+
+	for (int i = 0; i < NATTR; i++) {
+		int n = D_sgrattr[i];
+
+		if (!(attr & (1 << i)) || !n || (n < 32 && (sent & (1u << n))))
+			continue;
+		if (n < 32)
+			sent |= 1u << n;
+		p += sprintf(p, ";%d", n);
+	}
+	return p;
+}
+
+/*
+ * SetAttr() and SetColor() combined for D_sgr displays: the transition
+ * is sent as a single ESC [ ... m, either switching off what is no
+ * longer wanted or starting over from a reset, whichever is shorter.
+ */
+static void SetRenditionSGR(int attr, uint32_t fg, uint32_t bg)
+{
+	char reset[128], delta[128], *p, *q;
+	int old = D_rend.attr, readd = 0, typ = 0;
+	uint32_t off = 0;
+	bool usedelta = true;
+
+	p = reset;
+	p += sprintf(p, ";0");
+	p = SGRAttr(p, attr);
+	if (D_hascolor && fg)
+		p = SGRColor(p, fg, false);
+	if (D_hascolor && bg)
+		p = SGRColor(p, bg, true);
+
+	q = delta;
+	*q = 0;
+	for (int i = 0; i < NATTR; i++) {
+		int n = D_sgrattr[i];
+
+		if (!(old & ~attr & (1 << i)) || !n)
+			continue;
+		if (n >= 10 || !sgroff[n]) {
+			usedelta = false;
+			break;
+		}
+		if (!(off & (1u << sgroff[n])))
+			q += sprintf(q, ";%d", sgroff[n]);
+		off |= 1u << sgroff[n];
+	}
+	/* switch on again what went off with a shared parameter, e.g. 22 */
+	for (int i = 0; i < NATTR; i++) {
+		int n = D_sgrattr[i];
+
+		if ((old & attr & (1 << i)) && n && n < 10 && (off & (1u << sgroff[n])))
+			readd |= 1 << i;
+	}
+	q = SGRAttr(q, (attr & ~old) | readd);
+	if (D_hascolor && fg != D_rend.colorfg) {
+		if (!fg && !D_CAX)
+			usedelta = false;
+		q = SGRColor(q, fg, false);
+	}
+	if (D_hascolor && bg != D_rend.colorbg) {
+		if (!bg && !D_CAX)
+			usedelta = false;
+		q = SGRColor(q, bg, true);
+	}
+
+	if (!usedelta || q - delta > p - reset)
+		q = reset;
+	else
+		q = delta;
+	if (*q) {
+		AddStr("\033[");
+		AddStr(strcmp(q, ";0") ? q + 1 : "");
+		AddChar('m');
+	}
+
+	for (int i = 0; i < NATTR; i++)
+		if (attr & (1 << i))
+			typ |= D_attrtyp[i];
+	D_atyp = typ;
+	D_rend.attr = attr;
+	D_rend.colorfg = fg;
+	D_rend.colorbg = bg;
+}
+
 void SetRendition(struct mchar *mc)
 {
 	if (!display)
 		return;
-	if (D_rend.attr != mc->attr)
-		SetAttr(mc->attr);
-	if (D_rend.colorbg != mc->colorbg || D_rend.colorfg != mc->colorfg)
-		SetColor(mc->colorfg, mc->colorbg);
+	if (D_sgr) {
+		if (D_rend.attr != mc->attr || D_rend.colorbg != mc->colorbg || D_rend.colorfg != mc->colorfg)
+			SetRenditionSGR(mc->attr, mc->colorfg, mc->colorbg);
+	} else {
+		if (D_rend.attr != mc->attr)
+			SetAttr(mc->attr);
+		if (D_rend.colorbg != mc->colorbg || D_rend.colorfg != mc->colorfg)
+			SetColor(mc->colorfg, mc->colorbg);
+	}
 	if (D_rend.font != mc->font)
 		SetFont(mc->font);
 }
 
 void SetRenditionMline(struct mline *ml, int x)
 {
+	struct mrend *r = &mrendtab[ml->rend[x]];
+
 	if (!display)
 		return;
-	if (D_rend.attr != ml->attr[x])
-		SetAttr(ml->attr[x]);
-	if (D_rend.colorbg != ml->colorbg[x]
-	    || D_rend.colorfg != ml->colorfg[x]) {
-		struct mchar mc;
-		copy_mline2mchar(&mc, ml, x);
-		SetColor(mc.colorfg, mc.colorbg);
+	if (D_sgr) {
+		if (D_rend.attr != r->attr || D_rend.colorbg != r->colorbg || D_rend.colorfg != r->colorfg)
+			SetRenditionSGR(r->attr, r->colorfg, r->colorbg);
+	} else {
+		if (D_rend.attr != r->attr)
+			SetAttr(r->attr);
+		if (D_rend.colorbg != r->colorbg || D_rend.colorfg != r->colorfg)
+			SetColor(r->colorfg, r->colorbg);
 	}
 	if (D_rend.font != ml->font[x])
 		SetFont(ml->font[x]);
@@ -1501,12 +2162,13 @@ void MakeStatus(char *msg)
 			AddChar('\b');
 		}
 		D_x = -1;
+		ShadowLost(STATLINE(), STATCOL(D_width, D_status_len), STATCOL(D_width, D_status_len) + D_status_len - 1);
 	} else {
 		D_status = STATUS_ON_HS;
 		ShowHStatus(msg);
 	}
 
-	D_status_obufpos = D_obufp - D_obuf;
+	D_status_obufpos = ObufUsed();
 
 	if (D_status == STATUS_ON_WIN) {
 		Display *olddisplay = display;
@@ -1606,9 +2268,12 @@ static int PrePutWinMsg(char *s, int start, int max)
 	   probably take way more time. So this will have to do for now. */
 	if (D_encoding == UTF8) {
 		int chars = strlen_onscreen((s + start), (s + max));
+		int x = D_x, y = D_y;
 		D_encoding = 0;
 		PutWinMsg(s, start, max + ((max - start) - chars));	/* Multibyte count */
 		D_encoding = UTF8;
+		if (chars != max - start)	/* the shadow got the bytes */
+			ShadowLost(y, x, D_width - 1);
 		D_x -= (max - chars);	/* Yak! But this is necessary to count for
 					   the fact that not every byte represents a
 					   character. */
@@ -1619,10 +2284,104 @@ static int PrePutWinMsg(char *s, int start, int max)
 	}
 }
 
+/* Sets cell x of ml to c in rendition rend, if the shadow can hold it */
+static bool WinMsgCell(struct mline *ml, int x, char c, struct mchar *rend)
+{
+	uint16_t r = mrend_index(rend);
+
+	if (c < ' ' || c > '~' || rend->font || (!r && (rend->attr | rend->colorbg | rend->colorfg)))
+		return false;
+	ml->image[x] = c;
+	ml->font[x] = 0;
+	ml->rend[x] = r;
+	return true;
+}
+
+/*
+ * Fills ml from column x with the first l bytes of message s, like
+ * PutWinMsg() would put them. rend is the rendition to start with and
+ * is left at the last one used. Fails for anything but printable ASCII.
+ */
+static bool WinMsgCells(struct mline *ml, int x, char *s, int l, struct mchar *rend)
+{
+	struct mchar rendstack[MAX_WINMSG_REND];
+	int rendstackn = 0;
+	int n = (g_winmsg && s == g_winmsg->buf) ? g_winmsg->numrend : 0;
+	int len = strlen(s);
+	int p = 0;
+
+	for (int i = 0; i < n && p < l; i++) {
+		if (p > g_winmsg->rendpos[i] || g_winmsg->rendpos[i] > len)
+			break;
+		for (; p < g_winmsg->rendpos[i] && p < l; p++)
+			if (!WinMsgCell(ml, x + p, s[p], rend))
+				return false;
+		if (g_winmsg->rend[i] == 0) {
+			if (rendstackn > 0)
+				*rend = rendstack[--rendstackn];
+		} else {
+			rendstack[rendstackn++] = *rend;
+			ApplyAttrColor(g_winmsg->rend[i], rend);
+		}
+	}
+	for (; p < len && p < l; p++)
+		if (!WinMsgCell(ml, x + p, s[p], rend))
+			return false;
+	return true;
+}
+
+/*
+ * Shows the first l bytes of message s from column x of line y, then
+ * spaces in its last rendition up to column pad and blanks up to column
+ * to. Only the cells in [from, to] that differ from the shadow screen
+ * are sent, so an unchanged caption or hardstatus costs nothing.
+ * Returns false if the message has to be put the old way.
+ */
+static bool PutWinMsgDiff(char *s, int l, int x, int y, int from, int to, int pad, struct mchar *rend)
+{
+	static struct mline ml;
+	static int mlwidth;
+	struct mchar r = *rend;
+	int e;
+
+	if (!D_shadow || D_shwidth != D_width || y < 0 || y >= D_shheight || x < 0 || to >= D_width)
+		return false;
+	if (mlwidth < D_width + 1) {
+		uint32_t *image = realloc(ml.image, (D_width + 1) * sizeof(uint32_t));
+		uint16_t *font, *rnd;
+
+		if (image)
+			ml.image = image;
+		font = realloc(ml.font, (D_width + 1) * sizeof(uint16_t));
+		if (font)
+			ml.font = font;
+		rnd = realloc(ml.rend, (D_width + 1) * sizeof(uint16_t));
+		if (rnd)
+			ml.rend = rnd;
+		if (!image || !font || !rnd)
+			return false;
+		mlwidth = D_width + 1;
+	}
+	if (!WinMsgCells(&ml, x, s, l, &r))
+		return false;
+	e = (int)strlen(s) < l ? (int)strlen(s) : l;
+	for (e += x; e <= to; e++)
+		if (e > pad) {
+			ml.image[e] = ' ';
+			ml.font[e] = 0;
+			ml.rend[e] = 0;
+		} else if (!WinMsgCell(&ml, e, ' ', &r))
+			return false;
+	ml.image[to + 1] = 0;
+	DisplayLine(&mline_blank, &ml, y, from, to);
+	return true;
+}
+
 /* refresh the display's hstatus line */
 void ShowHStatus(char *str)
 {
 	int l, ox, oy, max;
+	bool pad;
 
 	if (D_status == STATUS_ON_WIN && (D_has_hstatus == HSTATUS_FIRSTLINE || D_has_hstatus == HSTATUS_LASTLINE) && STATLINE() == D_height - 1)
 		return;		/* sorry, in use */
@@ -1654,14 +2413,17 @@ void ShowHStatus(char *str)
 		l = strlen(str);
 		if (l > D_width)
 			l = D_width;
-		GotoPos(0, D_height - 1);
-		SetRendition(&mchar_null);
-		l = PrePutWinMsg(str, 0, l);
-		if (!captionalways && D_cvlist && !D_cvlist->c_next)
-			while (l++ < D_width)
-				PUTCHARLP(' ');
-		if (l < D_width)
-			ClearArea(l, D_height - 1, l, D_width - 1, D_width - 1, D_height - 1, 0, 0);
+		pad = !captionalways && D_cvlist && !D_cvlist->c_next;
+		if (!PutWinMsgDiff(str, l, 0, D_height - 1, 0, D_width - 1, pad ? D_width - 1 : -1, &mchar_null)) {
+			GotoPos(0, D_height - 1);
+			SetRendition(&mchar_null);
+			l = PrePutWinMsg(str, 0, l);
+			if (pad)
+				while (l++ < D_width)
+					PUTCHARLP(' ');
+			if (l < D_width)
+				ClearArea(l, D_height - 1, l, D_width - 1, D_width - 1, D_height - 1, 0, 0);
+		}
 		if (ox != -1 && oy != -1)
 			GotoPos(ox, oy);
 		D_hstatus = (str != NULL);
@@ -1673,14 +2435,17 @@ void ShowHStatus(char *str)
 		l = strlen(str);
 		if (l > D_width)
 			l = D_width;
-		GotoPos(0, 0);
-		SetRendition(&mchar_null);
-		l = PrePutWinMsg(str, 0, l);
-		if (!captionalways || (D_cvlist && !D_cvlist->c_next))
-			while (l++ < D_width)
-				PUTCHARLP(' ');
-		if (l < D_width)
-			ClearArea(l, 0, l, D_width - 1, D_width - 1, 0, 0, 0);
+		pad = !captionalways || (D_cvlist && !D_cvlist->c_next);
+		if (!PutWinMsgDiff(str, l, 0, 0, 0, D_width - 1, pad ? D_width - 1 : -1, &mchar_null)) {
+			GotoPos(0, 0);
+			SetRendition(&mchar_null);
+			l = PrePutWinMsg(str, 0, l);
+			if (pad)
+				while (l++ < D_width)
+					PUTCHARLP(' ');
+			if (l < D_width)
+				ClearArea(l, 0, l, D_width - 1, D_width - 1, 0, 0, 0);
+		}
 		if (ox != -1 && oy != -1)
 			GotoPos(ox, oy);
 		D_hstatus = (str != NULL);
@@ -1727,7 +2492,12 @@ void RefreshAll(int isblank)
 
 void RefreshArea(int xs, int ys, int xe, int ye, int isblank)
 {
-	if (!isblank && xs == 0 && xe == D_width - 1 && ye == D_height - 1 && (ys == 0 || D_CD)) {
+	int known = 0;
+
+	/* clearing first only pays off if the terminal shows mostly unknown lines */
+	for (int y = ys; D_shadow && y <= ye; y++)
+		known += D_shadowok[y];
+	if (!isblank && known * 2 <= ye - ys && xs == 0 && xe == D_width - 1 && ye == D_height - 1 && (ys == 0 || D_CD)) {
 		ClearArea(xs, ys, xs, xe, xe, ye, 0, 0);
 		isblank = 1;
 	}
@@ -1750,11 +2520,13 @@ void RefreshLine(int y, int from, int to, int isblank)
 		return;		/* can't refresh status */
 	}
 
-	if (isblank == 0 && D_CE && to == D_width - 1 && from < to && D_status != STATUS_ON_HS) {
+	if (isblank == 0 && D_CE && to == D_width - 1 && from < to && D_status != STATUS_ON_HS
+	    && !(D_shadow && D_shadowok[y])) {
 		GotoPos(from, y);
 		if (D_UT || D_BE)
 			SetRendition(&mchar_null);
 		AddCStr(D_CE);
+		ShadowClear(y, from, to, 0);
 		isblank = 1;
 	}
 
@@ -1778,10 +2550,14 @@ void RefreshLine(int y, int from, int to, int isblank)
 					evenq(&cv->c_captev);
 				xx = to > cv->c_xe ? cv->c_xe : to;
 				l = strlen(buf);
-				GotoPos(from, y);
-				SetRendition(&mchar_so);
 				if (l > xx - cv->c_xs + 1)
 					l = xx - cv->c_xs + 1;
+				if (!extrabytes && PutWinMsgDiff(buf, l, cv->c_xs, y, from, xx, xx, &mchar_so)) {
+					from = xx + 1;
+					break;
+				}
+				GotoPos(from, y);
+				SetRendition(&mchar_so);
 				l = PrePutWinMsg(buf, from - cv->c_xs, l + extrabytes);
 				from = cv->c_xs + l;
 				for (; from <= xx; from++)
@@ -1900,11 +2676,13 @@ void ClearLine(struct mline *oml, int y, int from, int to, int bce)
 	if (from == 0 && D_CB && (to != D_width - 1 || (D_x == to && D_y == y)) && (!bce || D_BE)) {
 		GotoPos(to, y);
 		AddCStr(D_CB);
+		ShadowClear(y, 0, to, bce);
 		return;
 	}
 	if (to == D_width - 1 && D_CE && (!bce || D_BE)) {
 		GotoPos(from, y);
 		AddCStr(D_CE);
+		ShadowClear(y, from, to, bce);
 		return;
 	}
 	if (oml == NULL)
@@ -1920,11 +2698,61 @@ void ClearLine(struct mline *oml, int y, int from, int to, int bce)
 	DisplayLine(oml, &mline_old, y, from, to);
 }
 
+/*
+ * Returns where the blanks at the end of ml start, if the terminal
+ * shows enough else there that clearing to the end of the line is
+ * cheaper than writing spaces, -1 otherwise.
+ */
+static int BlankTail(struct mline *oml, struct mline *ml, int from, int to)
+{
+	int x, n = 0;
+
+	for (x = to; x >= from && cmp_mchar_mline(&mchar_blank, ml, x); x--)
+		if (!cmp_mchar_mline(&mchar_blank, oml, x))
+			n++;
+	return n > 3 ? x + 1 : -1;
+}
+
+/* cells compared per memcmp() call when skipping unchanged runs */
+#define SKIP_CHUNK 16
+
+/*
+ * Returns the first column in [x, to] where ml differs from oml, to + 1
+ * if there is none. Unchanged runs are skipped a chunk at a time, and
+ * planes both lines share (null16 mostly) are not looked at.
+ */
+static int SkipSameCells(struct mline *oml, struct mline *ml, int x, int to)
+{
+	bool image = oml->image != ml->image;
+	bool font = oml->font != ml->font;
+	bool rend = oml->rend != ml->rend;
+
+	while (x + SKIP_CHUNK - 1 <= to) {
+		if (image && memcmp(oml->image + x, ml->image + x, SKIP_CHUNK * 4))
+			break;
+		if (font && memcmp(oml->font + x, ml->font + x, SKIP_CHUNK * 2))
+			break;
+		if (rend && memcmp(oml->rend + x, ml->rend + x, SKIP_CHUNK * 2))
+			break;
+		x += SKIP_CHUNK;
+	}
+	while (x <= to && cmp_mline(oml, ml, x))
+		x++;
+	return x;
+}
+
 void DisplayLine(struct mline *oml, struct mline *ml, int y, int from, int to)
 {
 	int x;
 	int last2flag = 0, delete_lp = 0;
+	int tail = -1;
 
+	if (D_shadow) {
+		/* we know better than the caller what the terminal shows */
+		oml = &D_shadow[y];
+		if (D_CE && to == D_width - 1 && ml != NULL && (tail = BlankTail(oml, ml, from, to)) >= 0)
+			to = tail - 1;
+	}
 	if (!D_CLP && y == D_bot && to == D_width - 1) {
 		if (D_lp_missing || !cmp_mline(oml, ml, to)) {
 			if ((D_IC || D_IM) && from < to && !dw_left(ml, to, D_encoding)) {
@@ -1947,6 +2775,8 @@ void DisplayLine(struct mline *oml, struct mline *ml, int y, int from, int to)
 	}
 	for (x = from; x <= to; x++) {
 		if (ml != NULL) {
+			if (x < to)
+				x = SkipSameCells(oml, ml, x, to - 1);
 			if ((x < to || x != D_width - 1 || ml->image[x + 1]))
 				if (cmp_mline(oml, ml, x))
 					continue;
@@ -1975,6 +2805,7 @@ void DisplayLine(struct mline *oml, struct mline *ml, int y, int from, int to)
 		SetRenditionMline(ml, x);
 		INSERTCHAR(ml->image[x]);
 	} else if (delete_lp) {
+		GotoPos(D_width - 1, y);
 		if (D_UT)
 			SetRendition(&mchar_null);
 		if (D_DC)
@@ -1983,6 +2814,15 @@ void DisplayLine(struct mline *oml, struct mline *ml, int y, int from, int to)
 			AddCStr2(D_CDC, 1);
 		else if (D_CE)
 			AddCStr(D_CE);
+		ShadowClear(y, D_width - 1, D_width - 1, 0);
+	} else if (tail >= 0) {
+		GotoPos(tail, y);
+		if (D_UT || D_BE)
+			SetRendition(&mchar_null);
+		AddCStr(D_CE);
+		ShadowClear(y, tail, D_width - 1, 0);
+		if (y == D_bot)
+			D_lp_missing = 0;
 	}
 }
 
@@ -2030,6 +2870,7 @@ void InsChar(struct mchar *c, int x, int xe, int y, struct mline *oml)
 			AddCStr(D_IC);
 		else
 			AddCStr2(D_CIC, c->mbcs ? 2 : 1);
+		ShadowShift(D_y, D_x, c->mbcs ? -2 : -1, 0);
 	}
 	SetRendition(c);
 	RAW_PUTCHAR(c->image);
@@ -2084,6 +2925,8 @@ void WrapChar(struct mchar *c, int x, int y, int xs, int ys, int xe, int ye, boo
 		InsChar(c, 0, xe, y, NULL);
 		return;
 	}
+	if (y == ye && D_y == y && D_x == D_width)
+		ShadowScroll(ys, ye, 1, D_BE ? bce : 0);	/* the terminal wraps and scrolls */
 	D_y = y;
 	D_x = 0;
 	SetRendition(c);
@@ -2206,21 +3049,76 @@ void AddStrn(char *str, int n)
 		AddChar(' ');
 }
 
+/* Appends len bytes to the output buffer as they are */
+void AddRaw(char *buf, int len)
+{
+	while (len > 0) {
+		int n = len;
+
+		if (n > D_obuffree - 1)
+			n = D_obuffree - 1;
+		if (n > D_obufend - D_obufp)
+			n = D_obufend - D_obufp;
+		if (n <= 0) {
+			AddChar(*buf);	/* makes room */
+			buf++;
+			len--;
+			continue;
+		}
+		memcpy(D_obufp, buf, n);
+		D_obufp += n;
+		D_obuffree -= n;
+		if (D_obufp == D_obufend)
+			D_obufp = D_obuf;
+		buf += n;
+		len -= n;
+	}
+}
+
+/*
+ * Describes the next size bytes of the output ring, which may wrap
+ * around, for writev(). Returns the number of iovecs used.
+ */
+static int ObufIov(struct iovec *iov, int size)
+{
+	iov[0].iov_base = D_obufhead;
+	iov[0].iov_len = size;
+	if (size <= D_obufend - D_obufhead)
+		return 1;
+	iov[0].iov_len = D_obufend - D_obufhead;
+	iov[1].iov_base = D_obuf;
+	iov[1].iov_len = size - iov[0].iov_len;
+	return 2;
+}
+
+/* Drops n written bytes from the output ring */
+static void ObufSkip(int n)
+{
+	D_obuffree += n;
+	if (n == ObufUsed()) {
+		/* empty, start over at the beginning */
+		D_obufhead = D_obufp = D_obuf;
+		return;
+	}
+	D_obufhead += n;
+	if (D_obufhead >= D_obufend)
+		D_obufhead -= D_obufend - D_obuf;
+}
+
 void Flush(int progress)
 {
 	int l;
 	int wr;
-	char *p;
+	struct iovec iov[2];
 
-	l = D_obufp - D_obuf;
+	l = ObufUsed();
 	if (l == 0)
 		return;
 	if (D_userfd < 0) {
-		D_obuffree += l;
-		D_obufp = D_obuf;
+		ForgetShadow();
+		ObufSkip(l);
 		return;
 	}
-	p = D_obuf;
 	if (!progress) {
 		fcntl(D_userfd, F_SETFL, 0);
 	}
@@ -2243,18 +3141,18 @@ void Flush(int progress)
 				break;
 			}
 		}
-		wr = write(D_userfd, p, l);
+		wr = writev(D_userfd, iov, ObufIov(iov, l));
 		if (wr <= 0) {
 			if (errno == EINTR)
 				continue;
 			break;
 		}
-		D_obuffree += wr;
-		p += wr;
+		ObufSkip(wr);
 		l -= wr;
 	}
-	D_obuffree += l;
-	D_obufp = D_obuf;
+	if (l)
+		ForgetShadow();	/* the rest is thrown away */
+	ObufSkip(l);
 	if (!progress) {
 		fcntl(D_userfd, F_SETFL, FNBLOCK);
 	}
@@ -2268,7 +3166,7 @@ void freetty(void)
 	if (D_userfd >= 0)
 		close(D_userfd);
 	D_userfd = -1;
-	D_obufp = NULL;
+	D_obufp = D_obufhead = D_obufend = NULL;
 	D_obuffree = 0;
 	if (D_obuf)
 		free(D_obuf);
@@ -2286,7 +3184,8 @@ void freetty(void)
 
 void Resize_obuf(void)
 {
-	int ind;
+	int used = 0;
+	char *buf;
 
 	if (D_status_obuffree >= 0) {
 		RemoveStatusMinWait();
@@ -2294,19 +3193,27 @@ void Resize_obuf(void)
 			return;
 	}
 	if (D_obuflen && D_obuf) {
-		ind = D_obufp - D_obuf;
+		used = ObufUsed();
 		D_obuflen += GRAIN;
 		D_obuffree += GRAIN;
-		D_obuf = realloc(D_obuf, D_obuflen);
 	} else {
-		ind = 0;
 		D_obuflen = GRAIN;
 		D_obuffree = GRAIN;
-		D_obuf = malloc(D_obuflen);
 	}
-	if (!D_obuf)
+	if ((buf = malloc(D_obuflen)) == NULL)
 		Panic(0, "Out of memory");
-	D_obufp = D_obuf + ind;
+	if (used) {
+		/* unwrap the ring into the new buffer */
+		struct iovec iov[2];
+		int n = ObufIov(iov, used);
+		memcpy(buf, iov[0].iov_base, iov[0].iov_len);
+		if (n > 1)
+			memcpy(buf + iov[0].iov_len, iov[1].iov_base, iov[1].iov_len);
+	}
+	free(D_obuf);
+	D_obuf = D_obufhead = buf;
+	D_obufp = buf + used;
+	D_obufend = buf + D_obuflen;
 	D_obuflenmax = D_obuflen - D_obufmax;
 }
 
@@ -2344,13 +3251,13 @@ void NukePending(void)
 	int oldcursorstyle = D_cursorstyle;
 
 	oldrend = D_rend;
-	len = D_obufp - D_obuf;
+	len = ObufUsed();
 
 	/* Throw away any output that we can... */
 	tcflush(D_userfd, TCOFLUSH);
 
-	D_obufp = D_obuf;
-	D_obuffree += len;
+	ObufSkip(len);
+	ForgetShadow();
 	D_top = D_bot = -1;
 	AddCStr(D_IS);
 	AddCStr(D_TI);
@@ -2395,6 +3302,45 @@ void NukePending(void)
 	}
 }
 
+/*
+ * Passthrough: output of a window that fills the display is sent to
+ * the terminal as it comes from the pty, see PassthroughOutput() in
+ * window.c. PassthroughBegin() brings the terminal to the state the
+ * emulator has reached, PassthroughEnd() takes over the cursor position
+ * the emulator ended up at, and forgets the rendition if SGR sequences
+ * were forwarded and the cells, as the terminal now shows the window
+ * image. The forwarded sequences never change the scrolling region.
+ */
+void PassthroughBegin(Window *p)
+{
+	if (!display)
+		return;
+	InsertMode(false);
+	ChangeScrollRegion(p->w_top, p->w_bot);
+	SetRendition(&p->w_rend);
+	GotoPos(p->w_x, p->w_y);
+}
+
+void PassthroughEnd(Window *p, bool sgr)
+{
+	if (!display)
+		return;
+	if (sgr) {
+		if (D_ME)
+			AddCStr(D_ME);
+		else
+			AddStr("\033[m");
+		D_rend = mchar_null;
+		D_atyp = 0;
+	}
+	if (p->w_x < p->w_width) {
+		D_x = p->w_x;
+		D_y = p->w_y;
+	} else
+		D_x = D_y = -1;	/* pending wrap */
+	ForgetShadow();
+}
+
 /* linux' select can't handle flow control, so wait 100ms if
  * we get EAGAIN
  */
@@ -2412,23 +3358,19 @@ static void disp_writeev_eagain(Event *event, void *data)
 static void disp_writeev_fn(Event *event, void *data)
 {
 	int len, size = OUTPUT_BLOCK_SIZE;
+	struct iovec iov[2];
 
 	(void)event; /* unused */
 
 	display = (Display *)data;
-	len = D_obufp - D_obuf;
+	len = ObufUsed();
 	if (len < size)
 		size = len;
 	if (D_status_obufpos && size > D_status_obufpos)
 		size = D_status_obufpos;
-	size = write(D_userfd, D_obuf, size);
+	size = writev(D_userfd, iov, ObufIov(iov, size));
 	if (size >= 0) {
-		len -= size;
-		if (len) {
-			memmove(D_obuf, D_obuf + size, len);
-		}
-		D_obufp -= size;
-		D_obuffree += size;
+		ObufSkip(size);
 		if (D_status_obufpos) {
 			D_status_obufpos -= size;
 			if (!D_status_obufpos) {
@@ -2452,17 +3394,17 @@ static void disp_writeev_fn(Event *event, void *data)
 				D_blocked_fuzz = 0;
 		}
 		if (D_blockedev.queued) {
-			if (D_obufp - D_obuf > D_obufmax / 2) {
+			if (ObufUsed() > D_obufmax / 2) {
 				SetTimeout(&D_blockedev, D_nonblock);
 			} else {
 				evdeq(&D_blockedev);
 			}
 		}
-		if (D_blocked == 1 && D_obuf == D_obufp) {
+		if (D_blocked == 1 && ObufUsed() == 0) {
 			/* empty again, restart output */
 			D_blocked = 0;
 			Activate(D_fore ? D_fore->w_norefresh : 0);
-			D_blocked_fuzz = D_obufp - D_obuf;
+			D_blocked_fuzz = ObufUsed();
 		}
 	} else {
 		/* linux flow control is badly broken */
@@ -2813,12 +3755,13 @@ static void disp_blocked_fn(Event *event, void *data)
 	(void)event; /* unused */
 
 	display = (Display *)data;
-	if (D_obufp - D_obuf > D_obufmax + D_blocked_fuzz) {
+	if (ObufUsed() > D_obufmax + D_blocked_fuzz) {
 		D_blocked = 1;
 		/* re-enable all windows */
 		for (Window *p = mru_window; p; p = p->w_prev_mru)
 			if (p->w_readev.condneg == &D_obuflenmax) {
 				p->w_readev.condpos = p->w_readev.condneg = NULL;
+				evgate(&p->w_readev);
 			}
 	}
 }
@@ -3021,6 +3964,7 @@ void RunBlanker(char **cmdv)
 	evenq(&D_blankerev);
 	D_blocked = 4;
 	ClearAll();
+	ForgetShadow();	/* the blanker draws over it */
 	if (slave != -1)
 		close(slave);
 }
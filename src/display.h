@@ -117,6 +117,9 @@ struct Display {
 	HardStatus	d_has_hstatus;		/* display has hardstatus line */
 	bool d_hstatus;		/* hardstatus used */
 	int	d_lp_missing;		/* last character on bot line missing */
+	struct mline *d_shadow;		/* cells as sent to the terminal */
+	char   *d_shadowok;		/* shadow line has no unknown cells */
+	int	d_shwidth, d_shheight;	/* size of the shadow */
 	int	d_mouse;			/* mouse mode */
 	int	d_extmouse;		/* extended mouse mode */
 	struct mouse_parse d_mouse_parse;	/* state of mouse code parsing */
@@ -151,7 +154,9 @@ struct Display {
 	struct mode d_NewMode;		/* New tty mode */
 	int	d_flow;			/* tty's flow control on/off flag*/
 	int   d_intrc;			/* current intr when flow is on */
-	char *d_obuf;			/* output buffer */
+	char *d_obuf;			/* output buffer, a ring */
+	char *d_obufend;		/* end of the buffer */
+	char *d_obufhead;		/* next byte to go to the tty */
 	int   d_obuflen;		/* len of buffer */
 	int	d_obufmax;		/* len where we are blocking the pty */
 	int	d_obuflenmax;		/* len - max */
@@ -168,13 +173,18 @@ struct Display {
 	int	d_dontmap;		/* do not map next */
 	int	d_mapdefault;		/* do map next to default */
 	union	tcu d_tcs[T_N];		/* terminal capabilities */
+	uint32_t d_tcsum;		/* checksum of them, see TermcapSum() */
 	char *d_attrtab[NATTR];		/* attrib emulation table */
 	char  d_attrtyp[NATTR];		/* attrib group table */
+	unsigned char d_sgrattr[NATTR];	/* SGR parameter of each attrib */
+	int   d_sgr;			/* attribs and colors are plain SGR */
 	int   d_hascolor;		/* do we support color */
 	char	d_c0_tab[256];		/* conversion for C0 */
 	char ***d_xtable;		/* char translation table */
 	int	d_UPcost, d_DOcost, d_LEcost, d_NDcost;
 	int	d_CRcost, d_IMcost, d_EIcost, d_NLcost;
+	short  *d_mvcost;		/* memoized costs of parametrized moves */
+	int	d_mvwidth, d_mvheight;	/* display size d_mvcost was made for */
 	int   d_printfd;		/* fd for vt100 print sequence */
 #ifdef ENABLE_UTMP
 	slot_t d_loginslot;		/* offset, where utmp_logintty belongs */
@@ -230,6 +240,10 @@ struct Display {
 #define D_has_hstatus	DISPLAY(d_has_hstatus)
 #define D_hstatus	DISPLAY(d_hstatus)
 #define D_lp_missing	DISPLAY(d_lp_missing)
+#define D_shadow	DISPLAY(d_shadow)
+#define D_shadowok	DISPLAY(d_shadowok)
+#define D_shwidth	DISPLAY(d_shwidth)
+#define D_shheight	DISPLAY(d_shheight)
 #define D_mouse		DISPLAY(d_mouse)
 #define D_mouse_parse	DISPLAY(d_mouse_parse)
 #define D_extmouse	DISPLAY(d_extmouse)
@@ -259,6 +273,8 @@ struct Display {
 #define D_flow		DISPLAY(d_flow)
 #define D_intr		DISPLAY(d_intr)
 #define D_obuf		DISPLAY(d_obuf)
+#define D_obufend	DISPLAY(d_obufend)
+#define D_obufhead	DISPLAY(d_obufhead)
 #define D_obuflen	DISPLAY(d_obuflen)
 #define D_obufmax	DISPLAY(d_obufmax)
 #define D_obuflenmax	DISPLAY(d_obuflenmax)
@@ -274,8 +290,11 @@ struct Display {
 #define D_mapdefault	DISPLAY(d_mapdefault)
 #define D_kmaps		DISPLAY(d_kmaps)
 #define D_tcs		DISPLAY(d_tcs)
+#define D_tcsum		DISPLAY(d_tcsum)
 #define D_attrtab	DISPLAY(d_attrtab)
 #define D_attrtyp	DISPLAY(d_attrtyp)
+#define D_sgrattr	DISPLAY(d_sgrattr)
+#define D_sgr		DISPLAY(d_sgr)
 #define D_hascolor	DISPLAY(d_hascolor)
 #define D_c0_tab	DISPLAY(d_c0_tab)
 #define D_xtable	DISPLAY(d_xtable)
@@ -287,6 +306,9 @@ struct Display {
 #define D_IMcost	DISPLAY(d_IMcost)
 #define D_EIcost	DISPLAY(d_EIcost)
 #define D_NLcost	DISPLAY(d_NLcost)
+#define D_mvcost	DISPLAY(d_mvcost)
+#define D_mvwidth	DISPLAY(d_mvwidth)
+#define D_mvheight	DISPLAY(d_mvheight)
 #define D_printfd	DISPLAY(d_printfd)
 #define D_loginslot	DISPLAY(d_loginslot)
 #define D_utmp_logintty	DISPLAY(d_utmp_logintty)
@@ -314,9 +336,15 @@ do				\
     if (--D_obuffree <= 0)	\
       Resize_obuf();		\
     *D_obufp++ = (c);		\
+    if (D_obufp == D_obufend)	\
+      D_obufp = D_obuf;		\
   }				\
 while (0)
 
+/* bytes in the output buffer that haven't been written yet */
+#define ObufUsed() (D_obufp >= D_obufhead ? D_obufp - D_obufhead \
+	: (D_obufend - D_obufhead) + (D_obufp - D_obuf))
+
 Display *MakeDisplay (char *, char *, char *, int, pid_t, struct mode *);
 void  FreeDisplay (void);
 void  DefProcess (char **, size_t *);
@@ -365,6 +393,7 @@ void  RemoveStatus (void);
 int   ResizeDisplay (int, int);
 void  AddStr (char *);
 void  AddStrn (char *, int);
+void  AddRaw (char *, int);
 void  Flush (int);
 void  freetty (void);
 void  Resize_obuf (void);
@@ -376,6 +405,13 @@ void  RunBlanker (char **);
 void  KillBlanker (void);
 void  DisplaySleep1000 (int, int);
 void  ClearScrollbackBuffer (void);
+void  ForgetShadow (void);
+void  FanoutReset (void);
+void  FanoutBegin (void);
+void  FanoutEnd (const void *, int, int, int);
+bool  FanoutReplay (const void *, int, int, int);
+void  PassthroughBegin (Window *);
+void  PassthroughEnd (Window *, bool);
 
 /* global variables */
 
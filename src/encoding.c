@@ -27,10 +27,14 @@
 
 #include <sys/types.h>
 #include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "screen.h"
 #include "fileio.h"
 #include "misc.h"
+#include "width.h"
 
 static int encmatch(char *, char *);
 static int recode_char(int, int, int);
@@ -481,7 +485,7 @@ struct mline *recode_mline(struct mline *ml, int w, int from, int to)
 
 	if (from == to || (from != UTF8 && to != UTF8) || w == 0)
 		return ml;
-	if (ml->font == null && encodings[from].deffont == 0)
+	if (ml->font == null16 && encodings[from].deffont == 0)
 		return ml;
 	if (w > maxlen) {
 		for (i = 0; i < 2; i++) {
@@ -490,9 +494,9 @@ struct mline *recode_mline(struct mline *ml, int w, int from, int to)
 			else
 				rml[i].image = realloc(rml[i].image, w * 4);
 			if (rml[i].font == NULL)
-				rml[i].font = malloc(w * 4);
+				rml[i].font = malloc(w * 2);
 			else
-				rml[i].font = realloc(rml[i].font, w * 4);
+				rml[i].font = realloc(rml[i].font, w * 2);
 			if (rml[i].image == NULL || rml[i].font == NULL) {
 				maxlen = 0;
 				return ml;	/* sorry */
@@ -502,9 +506,7 @@ struct mline *recode_mline(struct mline *ml, int w, int from, int to)
 	}
 
 	rl = rml + last;
-	rl->attr = ml->attr;
-	rl->colorbg = ml->colorbg;
-	rl->colorfg = ml->colorfg;
+	rl->rend = ml->rend;
 	for (i = 0; i < w; i++) {
 		c = ml->image[i] | (ml->font[i] << 8);
 		if (from != UTF8 && c < 256)
@@ -651,6 +653,108 @@ int FromUtf8(int c, int *utf8charp)
 	return c;
 }
 
+static inline bool utf8_iscont(unsigned char c)
+{
+	return (c & 0xc0) == 0x80;
+}
+
+/*
+ * Decode up to max characters of buf into chars, with the same result
+ * as feeding the bytes one by one to FromUtf8(). lens[i] is the number
+ * of bytes of buf that make up chars[i]; it is 0 for the replacement
+ * character of a sequence that was broken by the next byte (which gets
+ * decoded again). A sequence that is incomplete at the end of buf is
+ * only taken into *statep if nothing else was decoded, so *statep is 0
+ * whenever *np > 0.
+ * Returns the number of bytes consumed.
+ */
+size_t FromUtf8Buf(const char *buf, size_t len, int *statep, int *chars, uint8_t *lens, size_t max, size_t *np)
+{
+	const unsigned char *s = (const unsigned char *)buf;
+	size_t i = 0, n = 0, start = 0;
+	int c;
+
+	while (i < len && n < max) {
+		if (*statep == 0) {
+			start = i;
+#ifdef __SSE2__
+			if (i + 16 <= len && n + 16 <= max) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+				if (_mm_movemask_epi8(v) == 0) {
+					/* 16 ASCII bytes, widen them to 16 characters */
+					const __m128i z = _mm_setzero_si128();
+					__m128i lo = _mm_unpacklo_epi8(v, z);
+					__m128i hi = _mm_unpackhi_epi8(v, z);
+					_mm_storeu_si128((__m128i *)(chars + n), _mm_unpacklo_epi16(lo, z));
+					_mm_storeu_si128((__m128i *)(chars + n + 4), _mm_unpackhi_epi16(lo, z));
+					_mm_storeu_si128((__m128i *)(chars + n + 8), _mm_unpacklo_epi16(hi, z));
+					_mm_storeu_si128((__m128i *)(chars + n + 12), _mm_unpackhi_epi16(hi, z));
+					memset(lens + n, 1, 16);
+					i += 16;
+					n += 16;
+					continue;
+				}
+			}
+#endif
+			c = s[i];
+			if (c < 0x80) {
+				chars[n] = c;
+				lens[n++] = 1;
+				i++;
+				continue;
+			}
+			/* well-formed sequences that are complete in buf */
+			if (c >= 0xc2 && c < 0xe0 && i + 1 < len && utf8_iscont(s[i + 1])) {
+				chars[n] = (c & 0x1f) << 6 | (s[i + 1] & 0x3f);
+				lens[n++] = 2;
+				i += 2;
+				continue;
+			}
+			if ((c & 0xf0) == 0xe0 && i + 2 < len && utf8_iscont(s[i + 1]) && utf8_iscont(s[i + 2])) {
+				c = (c & 0x0f) << 12 | (s[i + 1] & 0x3f) << 6 | (s[i + 2] & 0x3f);
+				if (c >= 0x800) {
+					if (c >= 0xd800 && (c <= 0xdfff || c == 0xfffe || c == 0xffff))
+						c = UCS_REPL;
+					chars[n] = c;
+					lens[n++] = 3;
+					i += 3;
+					continue;
+				}
+			} else if ((c & 0xf8) == 0xf0 && i + 3 < len && utf8_iscont(s[i + 1]) && utf8_iscont(s[i + 2])
+				   && utf8_iscont(s[i + 3])) {
+				c = (c & 0x07) << 18 | (s[i + 1] & 0x3f) << 12 | (s[i + 2] & 0x3f) << 6 | (s[i + 3] & 0x3f);
+				if (c >= 0x10000) {
+					chars[n] = c;
+					lens[n++] = 4;
+					i += 4;
+					continue;
+				}
+			}
+		}
+		/* everything else goes through the state machine */
+		c = FromUtf8(s[i], statep);
+		if (c == -1) {
+			i++;
+			continue;
+		}
+		if (c == -2) {
+			chars[n] = UCS_REPL;
+			lens[n++] = i - start;
+			continue;
+		}
+		i++;
+		chars[n] = c;
+		lens[n++] = i - start;
+	}
+	if (*statep && n > 0) {
+		/* leave the unfinished sequence for the next call */
+		*statep = 0;
+		i = start;
+	}
+	*np = n;
+	return i;
+}
+
 void WinSwitchEncoding(Window *p, int encoding)
 {
 	int i, j, c;
@@ -675,19 +779,22 @@ void WinSwitchEncoding(Window *p, int encoding)
 				}
 			}
 	flayer = oldflayer;
+	sb_unpackall(p);
 	for (j = 0; j < p->w_height + p->w_histheight; j++) {
 		ml = j < p->w_height ? &p->w_mlines[j] : &p->w_hlines[j - p->w_height];
-		if (ml->font == null && encodings[p->w_encoding].deffont == 0)
+		if (ml->font == null16 && encodings[p->w_encoding].deffont == 0)
 			continue;
+		if (j >= p->w_height)
+			sb_thaw(&p->w_sb, ml);
 		for (i = 0; i < p->w_width; i++) {
 			c = ml->image[i] | (ml->font[i] << 8);
 			if (p->w_encoding != UTF8 && c < 256)
 				c |= encodings[p->w_encoding].deffont << 8;
 			if (c < 256)
 				continue;
-			if (ml->font == null) {
-				if ((ml->font = calloc(p->w_width + 1, 4)) == NULL) {
-					ml->font = null;
+			if (ml->font == null16) {
+				if ((ml->font = calloc(p->w_width + 1, 2)) == NULL) {
+					ml->font = null16;
 					break;
 				}
 			}
@@ -709,402 +816,27 @@ void WinSwitchEncoding(Window *p, int encoding)
 			ml->image[i] = c & 255;
 			ml->font[i] = c >> 8 & 255;
 		}
+		if (j >= p->w_height)
+			sb_freeze(&p->w_sb, ml, p->w_width + 1);
 	}
 	p->w_encoding = encoding;
+	sb_packall(p);
 	return;
 }
 
-struct interval {
-	uint32_t first;
-	uint32_t last;
-};
-
-/* auxiliary function for binary search in interval table */
-static bool bisearch(const uint32_t ucs, const struct interval *table, const size_t size)
-{
-	size_t min = 0;
-	size_t max = size;
-
-	if (ucs < table[0].first || ucs > table[max].last)
-		return 0;
-	while (max >= min) {
-		size_t mid = (min + max) / 2;
-		if (ucs > table[mid].last)
-			min = mid + 1;
-		else if (ucs < table[mid].first)
-			max = mid - 1;
-		else
-			return 1;
-	}
-
-	return 0;
-}
-
 bool utf8_isdouble(uint32_t c)
 {
-	/* A sorted list of intervals of ambiguous width characters generated by
-	 * https://github.com/GNOME/glib/blob/glib-2-50/glib/gen-unicode-tables.pl */
-	static const struct interval ambiguous[] = {
-		{0x00A1, 0x00A1},
-		{0x00A4, 0x00A4},
-		{0x00A7, 0x00A8},
-		{0x00AA, 0x00AA},
-		{0x00AD, 0x00AE},
-		{0x00B0, 0x00B4},
-		{0x00B6, 0x00BA},
-		{0x00BC, 0x00BF},
-		{0x00C6, 0x00C6},
-		{0x00D0, 0x00D0},
-		{0x00D7, 0x00D8},
-		{0x00DE, 0x00E1},
-		{0x00E6, 0x00E6},
-		{0x00E8, 0x00EA},
-		{0x00EC, 0x00ED},
-		{0x00F0, 0x00F0},
-		{0x00F2, 0x00F3},
-		{0x00F7, 0x00FA},
-		{0x00FC, 0x00FC},
-		{0x00FE, 0x00FE},
-		{0x0101, 0x0101},
-		{0x0111, 0x0111},
-		{0x0113, 0x0113},
-		{0x011B, 0x011B},
-		{0x0126, 0x0127},
-		{0x012B, 0x012B},
-		{0x0131, 0x0133},
-		{0x0138, 0x0138},
-		{0x013F, 0x0142},
-		{0x0144, 0x0144},
-		{0x0148, 0x014B},
-		{0x014D, 0x014D},
-		{0x0152, 0x0153},
-		{0x0166, 0x0167},
-		{0x016B, 0x016B},
-		{0x01CE, 0x01CE},
-		{0x01D0, 0x01D0},
-		{0x01D2, 0x01D2},
-		{0x01D4, 0x01D4},
-		{0x01D6, 0x01D6},
-		{0x01D8, 0x01D8},
-		{0x01DA, 0x01DA},
-		{0x01DC, 0x01DC},
-		{0x0251, 0x0251},
-		{0x0261, 0x0261},
-		{0x02C4, 0x02C4},
-		{0x02C7, 0x02C7},
-		{0x02C9, 0x02CB},
-		{0x02CD, 0x02CD},
-		{0x02D0, 0x02D0},
-		{0x02D8, 0x02DB},
-		{0x02DD, 0x02DD},
-		{0x02DF, 0x02DF},
-		{0x0300, 0x036F},
-		{0x0391, 0x03A1},
-		{0x03A3, 0x03A9},
-		{0x03B1, 0x03C1},
-		{0x03C3, 0x03C9},
-		{0x0401, 0x0401},
-		{0x0410, 0x044F},
-		{0x0451, 0x0451},
-		{0x2010, 0x2010},
-		{0x2013, 0x2016},
-		{0x2018, 0x2019},
-		{0x201C, 0x201D},
-		{0x2020, 0x2022},
-		{0x2024, 0x2027},
-		{0x2030, 0x2030},
-		{0x2032, 0x2033},
-		{0x2035, 0x2035},
-		{0x203B, 0x203B},
-		{0x203E, 0x203E},
-		{0x2074, 0x2074},
-		{0x207F, 0x207F},
-		{0x2081, 0x2084},
-		{0x20AC, 0x20AC},
-		{0x2103, 0x2103},
-		{0x2105, 0x2105},
-		{0x2109, 0x2109},
-		{0x2113, 0x2113},
-		{0x2116, 0x2116},
-		{0x2121, 0x2122},
-		{0x2126, 0x2126},
-		{0x212B, 0x212B},
-		{0x2153, 0x2154},
-		{0x215B, 0x215E},
-		{0x2160, 0x216B},
-		{0x2170, 0x2179},
-		{0x2189, 0x2189},
-		{0x2190, 0x2199},
-		{0x21B8, 0x21B9},
-		{0x21D2, 0x21D2},
-		{0x21D4, 0x21D4},
-		{0x21E7, 0x21E7},
-		{0x2200, 0x2200},
-		{0x2202, 0x2203},
-		{0x2207, 0x2208},
-		{0x220B, 0x220B},
-		{0x220F, 0x220F},
-		{0x2211, 0x2211},
-		{0x2215, 0x2215},
-		{0x221A, 0x221A},
-		{0x221D, 0x2220},
-		{0x2223, 0x2223},
-		{0x2225, 0x2225},
-		{0x2227, 0x222C},
-		{0x222E, 0x222E},
-		{0x2234, 0x2237},
-		{0x223C, 0x223D},
-		{0x2248, 0x2248},
-		{0x224C, 0x224C},
-		{0x2252, 0x2252},
-		{0x2260, 0x2261},
-		{0x2264, 0x2267},
-		{0x226A, 0x226B},
-		{0x226E, 0x226F},
-		{0x2282, 0x2283},
-		{0x2286, 0x2287},
-		{0x2295, 0x2295},
-		{0x2299, 0x2299},
-		{0x22A5, 0x22A5},
-		{0x22BF, 0x22BF},
-		{0x2312, 0x2312},
-		{0x2460, 0x24E9},
-		{0x24EB, 0x254B},
-		{0x2550, 0x2573},
-		{0x2580, 0x258F},
-		{0x2592, 0x2595},
-		{0x25A0, 0x25A1},
-		{0x25A3, 0x25A9},
-		{0x25B2, 0x25B3},
-		{0x25B6, 0x25B7},
-		{0x25BC, 0x25BD},
-		{0x25C0, 0x25C1},
-		{0x25C6, 0x25C8},
-		{0x25CB, 0x25CB},
-		{0x25CE, 0x25D1},
-		{0x25E2, 0x25E5},
-		{0x25EF, 0x25EF},
-		{0x2605, 0x2606},
-		{0x2609, 0x2609},
-		{0x260E, 0x260F},
-		{0x261C, 0x261C},
-		{0x261E, 0x261E},
-		{0x2640, 0x2640},
-		{0x2642, 0x2642},
-		{0x2660, 0x2661},
-		{0x2663, 0x2665},
-		{0x2667, 0x266A},
-		{0x266C, 0x266D},
-		{0x266F, 0x266F},
-		{0x269E, 0x269F},
-		{0x26BF, 0x26BF},
-		{0x26C6, 0x26CD},
-		{0x26CF, 0x26D3},
-		{0x26D5, 0x26E1},
-		{0x26E3, 0x26E3},
-		{0x26E8, 0x26E9},
-		{0x26EB, 0x26F1},
-		{0x26F4, 0x26F4},
-		{0x26F6, 0x26F9},
-		{0x26FB, 0x26FC},
-		{0x26FE, 0x26FF},
-		{0x273D, 0x273D},
-		{0x2776, 0x277F},
-		{0x2B56, 0x2B59},
-		{0x3248, 0x324F},
-		{0xE000, 0xF8FF},
-		{0xFE00, 0xFE0F},
-		{0xFFFD, 0xFFFD},
-		{0x1F100, 0x1F10A},
-		{0x1F110, 0x1F12D},
-		{0x1F130, 0x1F169},
-		{0x1F170, 0x1F18D},
-		{0x1F18F, 0x1F190},
-		{0x1F19B, 0x1F1AC},
-		{0xE0100, 0xE01EF},
-		{0xF0000, 0xFFFFD},
-		{0x100000, 0x10FFFD},
-	};
-
-	/* A sorted list of intervals of double width characters generated by
-	 * https://github.com/GNOME/glib/blob/glib-2-50/glib/gen-unicode-tables.pl */
-	static const struct interval wide[] = {
-		{0x1100, 0x115F},
-		{0x231A, 0x231B},
-		{0x2329, 0x232A},
-		{0x23E9, 0x23EC},
-		{0x23F0, 0x23F0},
-		{0x23F3, 0x23F3},
-		{0x25FD, 0x25FE},
-		{0x2614, 0x2615},
-		{0x2648, 0x2653},
-		{0x267F, 0x267F},
-		{0x2693, 0x2693},
-		{0x26A1, 0x26A1},
-		{0x26AA, 0x26AB},
-		{0x26BD, 0x26BE},
-		{0x26C4, 0x26C5},
-		{0x26CE, 0x26CE},
-		{0x26D4, 0x26D4},
-		{0x26EA, 0x26EA},
-		{0x26F2, 0x26F3},
-		{0x26F5, 0x26F5},
-		{0x26FA, 0x26FA},
-		{0x26FD, 0x26FD},
-		{0x2705, 0x2705},
-		{0x270A, 0x270B},
-		{0x2728, 0x2728},
-		{0x274C, 0x274C},
-		{0x274E, 0x274E},
-		{0x2753, 0x2755},
-		{0x2757, 0x2757},
-		{0x2795, 0x2797},
-		{0x27B0, 0x27B0},
-		{0x27BF, 0x27BF},
-		{0x2B1B, 0x2B1C},
-		{0x2B50, 0x2B50},
-		{0x2B55, 0x2B55},
-		{0x2E80, 0x2E99},
-		{0x2E9B, 0x2EF3},
-		{0x2F00, 0x2FD5},
-		{0x2FF0, 0x2FFB},
-		{0x3000, 0x303E},
-		{0x3041, 0x3096},
-		{0x3099, 0x30FF},
-		{0x3105, 0x312F},
-		{0x3131, 0x318E},
-		{0x3190, 0x31BA},
-		{0x31C0, 0x31E3},
-		{0x31F0, 0x321E},
-		{0x3220, 0x3247},
-		{0x3250, 0x4DBF},
-		{0x4E00, 0xA48C},
-		{0xA490, 0xA4C6},
-		{0xA960, 0xA97C},
-		{0xAC00, 0xD7A3},
-		{0xF900, 0xFAFF},
-		{0xFE10, 0xFE19},
-		{0xFE30, 0xFE52},
-		{0xFE54, 0xFE66},
-		{0xFE68, 0xFE6B},
-		{0xFF01, 0xFF60},
-		{0xFFE0, 0xFFE6},
-		{0x16FE0, 0x16FE3},
-		{0x17000, 0x187F7},
-		{0x18800, 0x18AF2},
-		{0x1B000, 0x1B11E},
-		{0x1B150, 0x1B152},
-		{0x1B164, 0x1B167},
-		{0x1B170, 0x1B2FB},
-		{0x1F004, 0x1F004},
-		{0x1F0CF, 0x1F0CF},
-		{0x1F18E, 0x1F18E},
-		{0x1F191, 0x1F19A},
-		{0x1F200, 0x1F202},
-		{0x1F210, 0x1F23B},
-		{0x1F240, 0x1F248},
-		{0x1F250, 0x1F251},
-		{0x1F260, 0x1F265},
-		{0x1F300, 0x1F320},
-		{0x1F32D, 0x1F335},
-		{0x1F337, 0x1F37C},
-		{0x1F37E, 0x1F393},
-		{0x1F3A0, 0x1F3CA},
-		{0x1F3CF, 0x1F3D3},
-		{0x1F3E0, 0x1F3F0},
-		{0x1F3F4, 0x1F3F4},
-		{0x1F3F8, 0x1F43E},
-		{0x1F440, 0x1F440},
-		{0x1F442, 0x1F4FC},
-		{0x1F4FF, 0x1F53D},
-		{0x1F54B, 0x1F54E},
-		{0x1F550, 0x1F567},
-		{0x1F57A, 0x1F57A},
-		{0x1F595, 0x1F596},
-		{0x1F5A4, 0x1F5A4},
-		{0x1F5FB, 0x1F64F},
-		{0x1F680, 0x1F6C5},
-		{0x1F6CC, 0x1F6CC},
-		{0x1F6D0, 0x1F6D2},
-		{0x1F6D5, 0x1F6D5},
-		{0x1F6EB, 0x1F6EC},
-		{0x1F6F4, 0x1F6FA},
-		{0x1F7E0, 0x1F7EB},
-		{0x1F90D, 0x1F971},
-		{0x1F973, 0x1F976},
-		{0x1F97A, 0x1F9A2},
-		{0x1F9A5, 0x1F9AA},
-		{0x1F9AE, 0x1F9CA},
-		{0x1F9CD, 0x1F9FF},
-		{0x1FA70, 0x1FA73},
-		{0x1FA78, 0x1FA7A},
-		{0x1FA80, 0x1FA82},
-		{0x1FA90, 0x1FA95},
-		{0x20000, 0x2FFFD},
-		{0x30000, 0x3FFFD},
-	};
+	int cls;
 
 	if (c >= 0xdf00 && c <= 0xdfff)
 		return 1;			/* dw combining sequence */
-	return ((bisearch(c, wide, ARRAY_SIZE(wide) - 1)) ||
-		(cjkwidth && bisearch(c, ambiguous, ARRAY_SIZE(ambiguous) - 1)));
+	cls = ucs_class(c);
+	return (cls & UCS_WIDE) || (cjkwidth && (cls & UCS_AMBIGUOUS));
 }
 
 bool utf8_iscomb(uint32_t c)
 {
-	/* taken from Markus Kuhn's wcwidth */
-	static const struct interval combining[] = {
-		{0x0300, 0x036F}, {0x0483, 0x0486}, {0x0488, 0x0489},
-		{0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2},
-		{0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0600, 0x0603},
-		{0x0610, 0x0615}, {0x064B, 0x065E}, {0x0670, 0x0670},
-		{0x06D6, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED},
-		{0x070F, 0x070F}, {0x0711, 0x0711}, {0x0730, 0x074A},
-		{0x07A6, 0x07B0}, {0x07EB, 0x07F3}, {0x0901, 0x0902},
-		{0x093C, 0x093C}, {0x0941, 0x0948}, {0x094D, 0x094D},
-		{0x0951, 0x0954}, {0x0962, 0x0963}, {0x0981, 0x0981},
-		{0x09BC, 0x09BC}, {0x09C1, 0x09C4}, {0x09CD, 0x09CD},
-		{0x09E2, 0x09E3}, {0x0A01, 0x0A02}, {0x0A3C, 0x0A3C},
-		{0x0A41, 0x0A42}, {0x0A47, 0x0A48}, {0x0A4B, 0x0A4D},
-		{0x0A70, 0x0A71}, {0x0A81, 0x0A82}, {0x0ABC, 0x0ABC},
-		{0x0AC1, 0x0AC5}, {0x0AC7, 0x0AC8}, {0x0ACD, 0x0ACD},
-		{0x0AE2, 0x0AE3}, {0x0B01, 0x0B01}, {0x0B3C, 0x0B3C},
-		{0x0B3F, 0x0B3F}, {0x0B41, 0x0B43}, {0x0B4D, 0x0B4D},
-		{0x0B56, 0x0B56}, {0x0B82, 0x0B82}, {0x0BC0, 0x0BC0},
-		{0x0BCD, 0x0BCD}, {0x0C3E, 0x0C40}, {0x0C46, 0x0C48},
-		{0x0C4A, 0x0C4D}, {0x0C55, 0x0C56}, {0x0CBC, 0x0CBC},
-		{0x0CBF, 0x0CBF}, {0x0CC6, 0x0CC6}, {0x0CCC, 0x0CCD},
-		{0x0CE2, 0x0CE3}, {0x0D41, 0x0D43}, {0x0D4D, 0x0D4D},
-		{0x0DCA, 0x0DCA}, {0x0DD2, 0x0DD4}, {0x0DD6, 0x0DD6},
-		{0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
-		{0x0EB1, 0x0EB1}, {0x0EB4, 0x0EB9}, {0x0EBB, 0x0EBC},
-		{0x0EC8, 0x0ECD}, {0x0F18, 0x0F19}, {0x0F35, 0x0F35},
-		{0x0F37, 0x0F37}, {0x0F39, 0x0F39}, {0x0F71, 0x0F7E},
-		{0x0F80, 0x0F84}, {0x0F86, 0x0F87}, {0x0F90, 0x0F97},
-		{0x0F99, 0x0FBC}, {0x0FC6, 0x0FC6}, {0x102D, 0x1030},
-		{0x1032, 0x1032}, {0x1036, 0x1037}, {0x1039, 0x1039},
-		{0x1058, 0x1059}, {0x1160, 0x11FF}, {0x135F, 0x135F},
-		{0x1712, 0x1714}, {0x1732, 0x1734}, {0x1752, 0x1753},
-		{0x1772, 0x1773}, {0x17B4, 0x17B5}, {0x17B7, 0x17BD},
-		{0x17C6, 0x17C6}, {0x17C9, 0x17D3}, {0x17DD, 0x17DD},
-		{0x180B, 0x180D}, {0x18A9, 0x18A9}, {0x1920, 0x1922},
-		{0x1927, 0x1928}, {0x1932, 0x1932}, {0x1939, 0x193B},
-		{0x1A17, 0x1A18}, {0x1B00, 0x1B03}, {0x1B34, 0x1B34},
-		{0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42},
-		{0x1B6B, 0x1B73}, {0x1DC0, 0x1DCA}, {0x1DFE, 0x1DFF},
-		{0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2063},
-		{0x206A, 0x206F}, {0x20D0, 0x20EF}, {0x302A, 0x302F},
-		{0x3099, 0x309A}, {0xA806, 0xA806}, {0xA80B, 0xA80B},
-		{0xA825, 0xA826}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F},
-		{0xFE20, 0xFE23}, {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB},
-		{0x10A01, 0x10A03}, {0x10A05, 0x10A06}, {0x10A0C, 0x10A0F},
-		{0x10A38, 0x10A3A}, {0x10A3F, 0x10A3F}, {0x1D167, 0x1D169},
-		{0x1D173, 0x1D182}, {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD},
-		{0x1D242, 0x1D244}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F},
-		{0xE0100, 0xE01EF}
-	};
-
-	return bisearch(c, combining, ARRAY_SIZE(combining) - 1);
+	return ucs_class(c) & UCS_COMBINING;
 }
 
 static void comb_tofront(int i)
@@ -1579,7 +1311,8 @@ int RecodeBuf(unsigned char *fbuf, int flen, int fenc, int tenc, unsigned char *
 
 int ContainsSpecialDeffont(struct mline *ml, int xs, int xe, int encoding)
 {
-	uint32_t *f, *i;
+	uint32_t *i;
+	uint16_t *f;
 	int c, x, dx;
 
 	if (encoding == UTF8 || encodings[encoding].deffont == 0)
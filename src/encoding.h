@@ -7,6 +7,7 @@ void  InitBuiltinTabs (void);
 struct mchar *recode_mchar (struct mchar *, int, int);
 struct mline *recode_mline (struct mline *, int, int, int);
 int   FromUtf8 (int, int *);
+size_t FromUtf8Buf (const char *, size_t, int *, int *, uint8_t *, size_t, size_t *);
 void  AddUtf8 (uint32_t);
 size_t ToUtf8 (char *, uint32_t);
 size_t ToUtf8_comb (char *, uint32_t);
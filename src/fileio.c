@@ -189,6 +189,7 @@ int StartRc(char *rcfilename, int nopanic)
 				continue;
 			}
 			AddStr(args[argc - 1]);
+			ForgetShadow();
 			if (argc != 3) {
 				AddStr("\r\n");
 				Flush(0);
@@ -407,7 +408,8 @@ void WriteFile(struct acluser *user, char *fn, int dump)
 		if (f == NULL) {
 			UserReturn(0);
 		} else {
-			uint32_t *p, *pf;
+			uint32_t *p;
+			uint16_t *pf;
 			switch (dump) {
 			case DUMP_HARDCOPY:
 			case DUMP_SCROLLBACK:
@@ -0,0 +1,193 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#include "config.h"
+
+#include "image.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "ansi.h"
+#include "window.h"
+
+/*
+ * The rendition table. Entries are looked up through an open addressing
+ * hash of their indexes; unused indexes are only found by
+ * MRendCollect(), which marks what the windows and the shadow screens
+ * of the displays still refer to.
+ */
+
+static struct mrend mrenddefault;
+struct mrend *mrendtab = &mrenddefault;
+
+static size_t mrendsize = 1;		/* allocated entries */
+static size_t mrendlen = 1;		/* entries ever handed out */
+static size_t mrendused = 1;		/* entries in use, with the default */
+static uint16_t *mrendhash;		/* index or 0 */
+static size_t mrendhashsize;		/* power of two */
+static uint16_t *mrendfree;		/* indexes given back by MRendCollect */
+static size_t mrendnfree;
+static uint16_t mrendlast;		/* last one looked up */
+static size_t mrendadded;		/* entries added since the last collection */
+
+static uint32_t MRendHash(uint32_t attr, uint32_t colorbg, uint32_t colorfg)
+{
+	return ((attr * 2654435761u) ^ colorbg) * 2246822519u ^ colorfg * 3266489917u;
+}
+
+static void MRendInsert(uint16_t i)
+{
+	struct mrend *r = &mrendtab[i];
+	size_t h = MRendHash(r->attr, r->colorbg, r->colorfg);
+
+	for (h &= mrendhashsize - 1; mrendhash[h]; h = (h + 1) & (mrendhashsize - 1))
+		;
+	mrendhash[h] = i;
+}
+
+static bool MRendGrowHash(void)
+{
+	size_t size = mrendhashsize ? mrendhashsize * 2 : 256;
+	uint16_t *old = mrendhash, *hash;
+	size_t oldsize = mrendhashsize;
+
+	if ((hash = calloc(size, sizeof(uint16_t))) == NULL)
+		return false;
+	mrendhash = hash;
+	mrendhashsize = size;
+	for (size_t h = 0; h < oldsize; h++)
+		if (old[h])
+			MRendInsert(old[h]);
+	free(old);
+	return true;
+}
+
+static bool MRendGrowTab(void)
+{
+	size_t size = mrendsize * 2 < 256 ? 256 : mrendsize * 2;
+	struct mrend *tab;
+
+	if (size > MREND_MAX + 1)
+		size = MREND_MAX + 1;
+	if (mrendtab == &mrenddefault) {
+		if ((tab = malloc(size * sizeof(struct mrend))) != NULL)
+			tab[0] = mrenddefault;
+	} else
+		tab = realloc(mrendtab, size * sizeof(struct mrend));
+	if (tab == NULL)
+		return false;
+	mrendtab = tab;
+	mrendsize = size;
+	return true;
+}
+
+/*
+ * Returns the index of a rendition, adding it to the table if needed.
+ * If the table is full (or we are out of memory) the cell gets the
+ * default rendition.
+ */
+uint16_t MRendIndex(uint32_t attr, uint32_t colorbg, uint32_t colorfg)
+{
+	struct mrend *r = &mrendtab[mrendlast];
+	size_t h;
+	uint16_t i;
+
+	if (r->attr == attr && r->colorbg == colorbg && r->colorfg == colorfg)
+		return mrendlast;
+	if (!(attr | colorbg | colorfg))
+		return 0;
+	h = MRendHash(attr, colorbg, colorfg);
+	for (size_t j = h & (mrendhashsize - 1); mrendhashsize && mrendhash[j]; j = (j + 1) & (mrendhashsize - 1)) {
+		r = &mrendtab[mrendhash[j]];
+		if (r->attr == attr && r->colorbg == colorbg && r->colorfg == colorfg)
+			return mrendlast = mrendhash[j];
+	}
+
+	if (mrendused * 2 >= mrendhashsize && !MRendGrowHash())
+		return 0;
+	if (mrendnfree)
+		i = mrendfree[--mrendnfree];
+	else {
+		if (mrendlen > MREND_MAX)
+			return 0;
+		if (mrendlen == mrendsize && !MRendGrowTab())
+			return 0;
+		i = mrendlen++;
+	}
+	mrendtab[i].attr = attr;
+	mrendtab[i].colorbg = colorbg;
+	mrendtab[i].colorfg = colorfg;
+	MRendInsert(i);
+	mrendused++;
+	mrendadded++;
+	return mrendlast = i;
+}
+
+static void MarkLines(uint8_t *marks, struct mline *ml, int n, int w)
+{
+	for (; n-- > 0; ml++) {
+		if (ml->rend == null16 || ml->rend == NULL)
+			continue;
+		for (int x = 0; x <= w; x++)
+			marks[ml->rend[x] >> 3] |= 1 << (ml->rend[x] & 7);
+	}
+}
+
+/*
+ * Frees the entries that no window line refers to any more, once the
+ * table gets crowded. Must not be called while renditions are held
+ * anywhere else, like in mline_old.
+ */
+void MRendCollect(void)
+{
+	uint8_t *marks;
+
+	if (mrendlen <= MREND_MAX / 4 * 3 || mrendnfree >= MREND_MAX / 8 || mrendadded < MREND_MAX / 8)
+		return;
+	if ((marks = calloc((MREND_MAX + 1) / 8, 1)) == NULL)
+		return;
+	if (mrendfree == NULL && (mrendfree = malloc((MREND_MAX + 1) * sizeof(uint16_t))) == NULL) {
+		free(marks);
+		return;
+	}
+	for (Window *win = mru_window; win; win = win->w_prev_mru) {
+		MarkLines(marks, win->w_mlines, win->w_height, win->w_width);
+		MarkLines(marks, win->w_hlines, win->w_histheight, win->w_width);
+		MarkLines(marks, win->w_alt.mlines, win->w_alt.height, win->w_alt.width);
+		MarkLines(marks, win->w_alt.hlines, win->w_alt.histheight, win->w_alt.width);
+	}
+	for (Display *d = displays; d; d = d->d_next)
+		MarkLines(marks, d->d_shadow, d->d_shheight, d->d_shwidth - 1);
+	memset(mrendhash, 0, mrendhashsize * sizeof(uint16_t));
+	mrendnfree = 0;
+	mrendused = 1;
+	for (size_t i = mrendlen - 1; i > 0; i--) {
+		if (marks[i >> 3] & (1 << (i & 7))) {
+			MRendInsert(i);
+			mrendused++;
+		} else
+			mrendfree[mrendnfree++] = i;
+	}
+	mrendlast = 0;
+	mrendadded = 0;
+	free(marks);
+}
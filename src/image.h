@@ -42,46 +42,57 @@ struct mchar {
 	uint32_t mbcs;		/* used for multi byte character sets; TODO: possible to remove? use image now that it has 32 bits*/
 };
 
+/*
+ * A line of cells. The attributes and colors of a cell are kept in
+ * mrendtab, the line only holds the index of the entry; index 0 is the
+ * default rendition. Planes without anything in them (font and rend)
+ * point at null16.
+ */
 struct mline {
 	uint32_t *image;
-	uint32_t *attr;
-	uint32_t *font;
-	uint32_t *colorbg;
-	uint32_t *colorfg;
+	uint16_t *font;		/* with UTF-8: high bits of image, 0xff for the right half of a wide char */
+	uint16_t *rend;		/* index into mrendtab */
+};
+
+/* attributes and colors, shared by all cells that look alike */
+struct mrend {
+	uint32_t attr;
+	uint32_t colorbg;
+	uint32_t colorfg;
 };
 
+#define MREND_MAX	0xffff	/* highest index into mrendtab */
+
+extern struct mrend *mrendtab;
+
+uint16_t MRendIndex(uint32_t, uint32_t, uint32_t);
+void	 MRendCollect(void);
 
+#define mrend_index(mc) \
+	((mc)->attr | (mc)->colorbg | (mc)->colorfg ? MRendIndex((mc)->attr, (mc)->colorbg, (mc)->colorfg) : 0)
 
 #define save_mline(ml, n) {					\
-	memmove(mline_old.image,   (ml)->image,   (n) * 4);	\
-	memmove(mline_old.attr,    (ml)->attr,    (n) * 4);	\
-	memmove(mline_old.font,    (ml)->font,    (n) * 4);	\
-	memmove(mline_old.colorbg, (ml)->colorbg, (n) * 4);	\
-	memmove(mline_old.colorfg, (ml)->colorfg, (n) * 4);	\
+	memmove(mline_old.image, (ml)->image, (n) * 4);		\
+	memmove(mline_old.font,  (ml)->font,  (n) * 2);		\
+	memmove(mline_old.rend,  (ml)->rend,  (n) * 2);		\
 }
 
 #define copy_mline(ml, xf, xt, n) {					\
-	memmove((ml)->image   + (xt), (ml)->image   + (xf), (n) * 4);	\
-	memmove((ml)->attr    + (xt), (ml)->attr    + (xf), (n) * 4);	\
-	memmove((ml)->font    + (xt), (ml)->font    + (xf), (n) * 4);	\
-	memmove((ml)->colorbg + (xt), (ml)->colorbg + (xf), (n) * 4);	\
-	memmove((ml)->colorfg + (xt), (ml)->colorfg + (xf), (n) * 4);	\
+	memmove((ml)->image + (xt), (ml)->image + (xf), (n) * 4);	\
+	memmove((ml)->font  + (xt), (ml)->font  + (xf), (n) * 2);	\
+	memmove((ml)->rend  + (xt), (ml)->rend  + (xf), (n) * 2);	\
 }
 
-#define clear_mline(ml, x, n) {							\
-	memmove((ml)->image + (x), blank, (n) * 4);				\
-	if ((ml)->attr    != null) memset((ml)->attr    + (x), 0, (n) * 4);	\
-	if ((ml)->font    != null) memset((ml)->font    + (x), 0, (n) * 4);	\
-	if ((ml)->colorbg != null) memset((ml)->colorbg + (x), 0, (n) * 4);	\
-	if ((ml)->colorfg != null) memset((ml)->colorfg + (x), 0, (n) * 4);	\
+#define clear_mline(ml, x, n) {						\
+	memmove((ml)->image + (x), blank, (n) * 4);			\
+	if ((ml)->font != null16) memset((ml)->font + (x), 0, (n) * 2);	\
+	if ((ml)->rend != null16) memset((ml)->rend + (x), 0, (n) * 2);	\
 }
 
 #define cmp_mline(ml1, ml2, x) (			\
-	   (ml1)->image[x]   == (ml2)->image[x]		\
-	&& (ml1)->attr[x]    == (ml2)->attr[x]		\
-	&& (ml1)->font[x]    == (ml2)->font[x]		\
-	&& (ml1)->colorbg[x] == (ml2)->colorbg[x]	\
-	&& (ml1)->colorfg[x] == (ml2)->colorfg[x]	\
+	   (ml1)->image[x] == (ml2)->image[x]		\
+	&& (ml1)->font[x]  == (ml2)->font[x]		\
+	&& (ml1)->rend[x]  == (ml2)->rend[x]		\
 )
 
 #define cmp_mchar(mc1, mc2) (				\
@@ -92,29 +103,27 @@ struct mline {
 	&& (mc1)->colorfg == (mc2)->colorfg		\
 )
 
-#define cmp_mchar_mline(mc, ml, x) (			\
-	   (mc)->image   == (ml)->image[x]		\
-	&& (mc)->attr    == (ml)->attr[x]		\
-	&& (mc)->font    == (ml)->font[x]		\
-	&& (mc)->colorbg == (ml)->colorbg[x]		\
-	&& (mc)->colorfg == (ml)->colorfg[x]		\
+#define cmp_mchar_mline(mc, ml, x) (				\
+	   (mc)->image   == (ml)->image[x]			\
+	&& (mc)->font    == (ml)->font[x]			\
+	&& (mc)->attr    == mrendtab[(ml)->rend[x]].attr	\
+	&& (mc)->colorbg == mrendtab[(ml)->rend[x]].colorbg	\
+	&& (mc)->colorfg == mrendtab[(ml)->rend[x]].colorfg	\
 )
 
 #define copy_mchar2mline(mc, ml, x) {			\
-	(ml)->image[x]   = (mc)->image;			\
-	(ml)->attr[x]    = (mc)->attr;			\
-	(ml)->font[x]    = (mc)->font;			\
-	(ml)->colorbg[x] = (mc)->colorbg;		\
-	(ml)->colorfg[x] = (mc)->colorfg;		\
+	(ml)->image[x] = (mc)->image;			\
+	(ml)->font[x]  = (mc)->font;			\
+	(ml)->rend[x]  = mrend_index(mc);		\
 }
 
-#define copy_mline2mchar(mc, ml, x) {			\
-	(mc)->image   = (ml)->image[x];			\
-	(mc)->attr    = (ml)->attr[x];			\
-	(mc)->font    = (ml)->font[x];			\
-	(mc)->colorbg = (ml)->colorbg[x];		\
-	(mc)->colorfg = (ml)->colorfg[x];		\
-	(mc)->mbcs    = 0;				\
+#define copy_mline2mchar(mc, ml, x) {				\
+	(mc)->image   = (ml)->image[x];				\
+	(mc)->attr    = mrendtab[(ml)->rend[x]].attr;		\
+	(mc)->font    = (ml)->font[x];				\
+	(mc)->colorbg = mrendtab[(ml)->rend[x]].colorbg;	\
+	(mc)->colorfg = mrendtab[(ml)->rend[x]].colorfg;	\
+	(mc)->mbcs    = 0;					\
 }
 
 enum {
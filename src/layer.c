@@ -52,16 +52,17 @@ static struct mline *mlineoffset(const struct mline *ml, const int offset)
 	if (ml == NULL)
 		return NULL;
 	mml.image = ml->image + offset;
-	mml.attr = ml->attr + offset;
 	mml.font = ml->font + offset;
-	mml.colorbg = ml->colorbg + offset;
-	mml.colorfg = ml->colorfg + offset;
+	mml.rend = ml->rend + offset;
 	return &mml;
 }
 
 #define RECODE_MCHAR(mc) ((l->l_encoding == UTF8) != (D_encoding == UTF8) ? recode_mchar(mc, l->l_encoding, D_encoding) : (mc))
 #define RECODE_MLINE(ml) ((l->l_encoding == UTF8) != (D_encoding == UTF8) ? recode_mline(ml, l->l_width, l->l_encoding, D_encoding) : (ml))
 
+/* Paused layers only skip split canvases, unless a frame is being collected */
+#define LayPaused(l, cv) ((l)->l_pause.d && ((cv)->c_slorient || (l)->l_pause.frame))
+
 void LGotoPos(Layer *l, int x, int y)
 {
 	int x2, y2;
@@ -70,7 +71,7 @@ void LGotoPos(Layer *l, int x, int y)
 		LayPauseUpdateRegion(l, x, x, y, y);
 
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		display = cv->c_display;
 		if (D_blocked)
@@ -107,7 +108,7 @@ void LScrollH(Layer *l, int n, int y, int xs, int xe, int bce, struct mline *ol)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, xs, xe, y, y);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			y2 = y + vp->v_yoff;
@@ -152,7 +153,7 @@ void LScrollV(Layer *l, int n, int ys, int ye, int bce)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, 0, l->l_width - 1, ys, ye);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			xs2 = vp->v_xoff;
@@ -201,7 +202,7 @@ void LInsChar(Layer *l, struct mchar *c, int x, int y, struct mline *ol)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, x, l->l_width - 1, y, y);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			y2 = y + vp->v_yoff;
@@ -247,8 +248,9 @@ void LPutChar(Layer *l, struct mchar *c, int x, int y)
 		LayPauseUpdateRegion(l, x, x + (c->mbcs ? 1 : 0)
 				     , y, y);
 
+	FanoutReset();
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		display = cv->c_display;
 		if (D_blocked)
@@ -260,7 +262,12 @@ void LPutChar(Layer *l, struct mchar *c, int x, int y)
 			x2 = x + vp->v_xoff;
 			if (x2 < vp->v_xs || x2 > vp->v_xe)
 				continue;
+			if (FanoutReplay(c, x2, x2 + (c->mbcs ? 1 : 0), y2))
+				break;
+			if (cv->c_lnext)
+				FanoutBegin();	/* others may want the same bytes */
 			PutChar(RECODE_MCHAR(c), x2, y2);
+			FanoutEnd(c, x2, x2 + (c->mbcs ? 1 : 0), y2);
 			break;
 		}
 	}
@@ -276,8 +283,9 @@ void LPutStr(Layer *l, char *s, int n, struct mchar *r, int x, int y)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, x, x + n - 1, y, y);
 
+	FanoutReset();
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			y2 = y + vp->v_yoff;
@@ -294,20 +302,24 @@ void LPutStr(Layer *l, char *s, int n, struct mchar *r, int x, int y)
 			display = cv->c_display;
 			if (D_blocked)
 				continue;
+			s2 = s + xs2 - x - vp->v_xoff;
+			if (FanoutReplay(s2, xs2, xe2, y2))
+				continue;
+			if (cv->c_lnext)
+				FanoutBegin();	/* others may want the same bytes */
 			GotoPos(xs2, y2);
 			SetRendition(r);
-			s2 = s + xs2 - x - vp->v_xoff;
 			if (D_encoding == UTF8 && l->l_encoding != UTF8 && (r->font || l->l_encoding)) {
 				struct mchar mc;
 				mc = *r;
-				while (xs2 <= xe2) {
+				for (int x2 = xs2; x2 <= xe2; x2++) {
 					mc.image = *s2++;
-					PutChar(RECODE_MCHAR(&mc), xs2++, y2);
+					PutChar(RECODE_MCHAR(&mc), x2, y2);
 				}
-				continue;
-			}
-			while (xs2++ <= xe2)
-				PUTCHARLP(*s2++);
+			} else
+				for (int x2 = xs2; x2 <= xe2; x2++)
+					PUTCHARLP(*s2++);
+			FanoutEnd(s + xs2 - x - vp->v_xoff, xs2, xe2, y2);
 		}
 	}
 }
@@ -325,7 +337,7 @@ void LPutWinMsg(Layer *l, char *s, int n, struct mchar *r, int x, int y)
 	if (len > n)
 		len = n;
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			y2 = y + vp->v_yoff;
@@ -372,7 +384,7 @@ void LClearLine(Layer *l, int y, int xs, int xe, int bce, struct mline *ol)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, xs, xe, y, y);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		for (Viewport *vp = cv->c_vplist; vp; vp = vp->v_next) {
 			xs2 = xs + vp->v_xoff;
@@ -410,7 +422,7 @@ void LClearArea(Layer *l, int xs, int ys, int xe, int ye, int bce, int uself)
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, xs, xe, ys, ye);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		display = cv->c_display;
 		if (D_blocked)
@@ -457,7 +469,7 @@ void LCDisplayLine(Layer *l, struct mline *ml, int y, int xs, int xe, int isblan
 	if (l->l_pause.d)
 		LayPauseUpdateRegion(l, xs, xe, y, y);
 	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-		if (l->l_pause.d && cv->c_slorient)
+		if (LayPaused(l, cv))
 			continue;
 		display = cv->c_display;
 		if (D_blocked)
@@ -524,7 +536,7 @@ void LWrapChar(Layer *l, struct mchar *c, int y, int top, int bot, bool ins)
 		yy = y == l->l_height - 1 ? y : y + 1;
 
 		for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-			if (l->l_pause.d && cv->c_slorient)
+			if (LayPaused(l, cv))
 				continue;
 			y2 = 0;	/* gcc -Wall */
 			display = cv->c_display;
@@ -567,7 +579,7 @@ void LWrapChar(Layer *l, struct mchar *c, int y, int top, int bot, bool ins)
 		/* hard case: scroll up */
 
 		for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext) {
-			if (l->l_pause.d && cv->c_slorient)
+			if (LayPaused(l, cv))
 				continue;
 			display = cv->c_display;
 			if (D_blocked)
@@ -714,13 +726,28 @@ void LClearAll(Layer *l, int uself)
 	LClearArea(l, 0, 0, l->l_width - 1, l->l_height - 1, 0, uself);
 }
 
+/*
+ * Whether a full refresh of the layer can skip clearing it first: the
+ * layer draws every cell of its lines, and all its displays compare
+ * that against their shadow screen.
+ */
+static bool LayShadowed(Layer *l)
+{
+	if (l->l_layfn != &WinLf && l->l_layfn != &MarkLf)
+		return false;
+	for (Canvas *cv = l->l_cvlist; cv; cv = cv->c_lnext)
+		if (!cv->c_display->d_shadow)
+			return false;
+	return true;
+}
+
 void LRefreshAll(Layer *l, int isblank)
 {
 	Layer *oldflayer;
 
 	oldflayer = flayer;
 	flayer = l;
-	if (!isblank)
+	if (!isblank && !LayShadowed(l))
 		LClearArea(l, 0, 0, l->l_width - 1, l->l_height - 1, 0, 0);
 	/* signal full refresh */
 	LayRedisplayLine(-1, -1, -1, 1);
@@ -937,22 +964,15 @@ void LayProcessMouseSwitch(Layer *l, bool start)
 	}
 }
 
-void LayPause(Layer *layer, bool pause)
+static void LayRefreshPaused(Layer *layer)
 {
 	Window *win;
 
-	if (layer->l_pause.d == pause)
-		return;
-
-	if ((layer->l_pause.d = pause)) {
-		/* Start pausing */
-		layer->l_pause.top = layer->l_pause.bottom = -1;
-		return;
-	}
-
-	/* Unpause. So refresh the regions in the displays! */
 	if (layer->l_pause.top == -1 && layer->l_pause.bottom == -1)
 		return;
+	/* the layer may have shrunk while a frame was collected */
+	if (layer->l_pause.bottom >= layer->l_height)
+		layer->l_pause.bottom = layer->l_height - 1;
 
 	if (layer->l_layfn == &WinLf)	/* Currently, this will always be the case! */
 		win = layer->l_data;
@@ -960,7 +980,7 @@ void LayPause(Layer *layer, bool pause)
 		win = NULL;
 
 	for (Canvas *cv = layer->l_cvlist; cv; cv = cv->c_lnext) {
-		if (!cv->c_slorient)
+		if (!cv->c_slorient && !layer->l_pause.frame)
 			continue;	/* Wasn't split, so already updated. */
 
 		display = cv->c_display;
@@ -1011,6 +1031,46 @@ void LayPause(Layer *layer, bool pause)
 
 	for (int line = layer->l_pause.top; line <= layer->l_pause.bottom; line++)
 		layer->l_pause.left[line] = layer->l_pause.right[line] = -1;
+	layer->l_pause.top = layer->l_pause.bottom = -1;
+}
+
+void LayPause(Layer *layer, bool pause)
+{
+	if (layer->l_pause.d == pause)
+		return;
+
+	if ((layer->l_pause.d = pause)) {
+		/* Start pausing, keeping what a pending frame collected */
+		if (!layer->l_pause.frame)
+			layer->l_pause.top = layer->l_pause.bottom = -1;
+		return;
+	}
+
+	/* Unpause. So refresh the regions in the displays! */
+	LayRefreshPaused(layer);
+	layer->l_pause.frame = false;
+}
+
+void LayPauseFrame(Layer *layer, bool pause)
+{
+	if (!pause) {
+		/* Leave the collected region for LayFlushFrame() */
+		layer->l_pause.d = false;
+		return;
+	}
+	if (!layer->l_pause.frame) {
+		layer->l_pause.top = layer->l_pause.bottom = -1;
+		layer->l_pause.frame = true;
+	}
+	layer->l_pause.d = true;
+}
+
+void LayFlushFrame(Layer *layer)
+{
+	if (!layer->l_pause.frame || layer->l_pause.d)
+		return;
+	LayRefreshPaused(layer);
+	layer->l_pause.frame = false;
 }
 
 void LayPauseUpdateRegion(Layer *layer, int xs, int xe, int ys, int ye)
@@ -86,6 +86,7 @@ struct Layer {
 		int *left, *right;
 		int top, bottom;
 		int lines;
+		bool frame;	/* Is the region kept for the next frame? */
 	} l_pause;
 };
 
@@ -143,6 +144,23 @@ struct Layer {
  */
 void LayPause (Layer *layer, bool pause);
 
+/**
+ * (Un)Pauses a layer for frame based updates (displayfps). Unlike
+ * LayPause, all canvases are paused and unpausing does not refresh
+ * anything: the region keeps growing until LayFlushFrame is called.
+ *
+ * @param layer The layer that should be (un)paused.
+ * @param pause Should we pause the layer?
+ */
+void LayPauseFrame (Layer *layer, bool pause);
+
+/**
+ * Refresh the region collected by LayPauseFrame on all canvases.
+ *
+ * @param layer The layer.
+ */
+void LayFlushFrame (Layer *layer);
+
 /**
  * Update the region to refresh after a layer is unpaused.
  *
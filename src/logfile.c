@@ -33,8 +33,12 @@
 #include <sys/types.h>		/* dev_t, ino_t, off_t, ... */
 #include <sys/stat.h>		/* struct stat */
 #include <fcntl.h>		/* O_WRONLY for logfile_reopen */
+#include <errno.h>
+#include <signal.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "screen.h"
 
@@ -43,8 +47,23 @@
 static void changed_logfile(Log *);
 static Log *lookup_logfile(char *);
 static int stolen_logfile(Log *);
+static int logfdrain(Log *, size_t);
+static void logwrite_fn(Event *, void *);
+static void logrotate_due(Log *);
+static int logrotate_now(Log *);
+static int logrotate_failed(Log *, int);
+static void logcompress(char *);
+static void logfdrainindex(Log *);
 
 static Log *logroot = NULL;
+static unsigned loggen;
+
+off_t logrotate_size = 0;
+int logrotate_interval = 0;
+char *logrotate_compress = NULL;
+
+/* writes out the logs with LOGBUF_WRITE bytes pending, see logfwrite() */
+static Event logwriteev = { .type = EV_TIMEOUT, .handler = logwrite_fn };
 
 static void changed_logfile(Log *l)
 {
@@ -78,17 +97,33 @@ int lf_move_fd(int fd, int need_fd)
 	return r;
 }
 
+/*
+ * The pending output still goes to the old file: the offsets a timed
+ * log has indexed refer to it. If a timed log was truncated in place,
+ * it is dropped instead, as it would land in front of the file's
+ * header. The new file is then started from scratch like a rotated one.
+ */
 static int logfile_reopen(char *name, int wantfd, Log *l)
 {
+	struct stat st;
 	int got_fd;
 
+	if (l->timed && stat(name, &st) == 0 && st.st_dev == l->st->st_dev && st.st_ino == l->st->st_ino) {
+		l->off = l->len = 0;
+		l->ilen = 0;
+	} else
+		logfdrain(l, l->len);
 	close(wantfd);
 	if (((got_fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0) || lf_move_fd(got_fd, wantfd) < 0) {
 		logfclose(l);
 		return -1;
 	}
-	changed_logfile(l);
-	l->st->st_ino = l->st->st_dev = 0;
+	memset(l->st, 0, sizeof(struct stat));
+	changed_logfile(l);	/* take over what is in there already */
+	if (l->idxfd >= 0)
+		close(l->idxfd);
+	l->idxfd = -1;
+	l->gen = ++loggen;
 	return 0;
 }
 
@@ -158,6 +193,9 @@ Log *logfopen(char *name, FILE * fp)
 	l->opencount = 1;
 	l->writecount = 0;
 	l->flushcount = 0;
+	l->since = time(NULL);
+	l->gen = ++loggen;
+	l->idxfd = -1;
 	changed_logfile(l);
 
 	l->next = logroot;
@@ -189,28 +227,186 @@ int logfclose(Log *l)
 		abort();
 
 	*lp = l->next;
+	logfdrain(l, l->len);
 	fclose(l->fp);
+	if (l->idxfd >= 0)
+		close(l->idxfd);
+	free(l->ibuf);
+	free(l->buf);
 	free(l->name);
 	free((char *)l);
 	return 0;
 }
 
+static int logfputs(Log *l, char *buf, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		if ((r = write(fileno(l->fp), buf, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		n -= r;
+	}
+	return 0;
+}
+
+/* writes out up to n buffered bytes, a failed write loses them */
+static int logfdrain(Log *l, size_t n)
+{
+	int r;
+
+	if (n > l->len - l->off)
+		n = l->len - l->off;
+	if (!n)
+		return 0;
+	r = logfputs(l, l->buf + l->off, n);
+	if ((l->off += n) == l->len)
+		l->off = l->len = 0;
+	changed_logfile(l);
+	if (!l->len)
+		logfdrainindex(l);
+	return r;
+}
+
 /*
- * XXX
- * write and flush both *should* check the file's stat, if it disappeared
- * or changed, re-open it.
+ * The index is only of use for replaying, so failing to write it is
+ * not worth stopping the log for; the entries are dropped then.
  */
-int logfwrite(Log *l, char *buf, size_t n)
+static void logfdrainindex(Log *l)
 {
-	int r;
+	char name[MAXPATHLEN];
+
+	if (!l->ilen)
+		return;
+	if (l->idxfd < 0 && snprintf(name, sizeof(name), "%s.idx", l->name) < (int)sizeof(name)) {
+		xseteuid(real_uid);
+		xsetegid(real_gid);
+		l->idxfd = open(name, O_WRONLY | O_CREAT | O_APPEND | (l->idxtrunc ? O_TRUNC : 0), 0666);
+		xseteuid(eff_uid);
+		xsetegid(eff_gid);
+	}
+	l->idxtrunc = false;
+	if (l->idxfd >= 0 && write(l->idxfd, l->ibuf, l->ilen) < 0) {
+		close(l->idxfd);
+		l->idxfd = -1;
+	}
+	l->ilen = 0;
+}
+
+/*
+ * Writes a slice of each log in turn until they are all written or
+ * LOGWRITE_MS have passed, so that a backlog doesn't keep the main loop
+ * busy for long. Each slice is a plain write(), which a stalled file
+ * system can still block. Whatever is left keeps piling up until
+ * logfwrite has to wait for it.
+ */
+static void logwrite_fn(Event *event, void *data)
+{
+	int64_t start = now_ms();
+	bool more;
+
+	(void)data; /* unused */
+
+	for (Log *l = logroot; l; l = l->next)
+		if (l->rotate && logrotate_now(l))
+			l->error = errno;
+	do {
+		more = false;
+		for (Log *l = logroot; l; l = l->next) {
+			if (l->len - l->off < LOGBUF_WRITE)
+				continue;
+			if (logfdrain(l, LOGBUF_WRITE))
+				l->error = errno;
+			more |= l->len - l->off >= LOGBUF_WRITE;
+		}
+	} while (more && now_ms() - start < LOGWRITE_MS);
+	if (more) {
+		SetTimeout(event, 0);
+		evenq(event);
+	}
+}
 
-	if (stolen_logfile(l) && logfile_reopen(l->name, fileno(l->fp), l))
+/*
+ * Log output is only collected here, the file is written in batches
+ * and checked for being moved away by logfflush(), which runs on a
+ * timer. So neither costs the emulator a system call per write.
+ */
+int logfwrite(Log *l, char *buf, size_t n)
+{
+	if (l->error) {
+		errno = l->error;
+		l->error = 0;
 		return -1;
-	r = fwrite(buf, n, 1, l->fp);
+	}
 	l->writecount += l->flushcount + 1;
 	l->flushcount = 0;
-	changed_logfile(l);
-	return r;
+	if (logffull(l, n) && logfdrain(l, l->len))
+		return -1;
+	if (l->len + n > l->size && l->off) {
+		memmove(l->buf, l->buf + l->off, l->len - l->off);
+		l->len -= l->off;
+		l->off = 0;
+	}
+	if (l->len + n > l->size) {
+		size_t size = l->size ? l->size : 4096;
+		char *nbuf;
+
+		while (size < l->len + n && size < LOGBUF_MAX)
+			size *= 2;
+		if (size < l->len + n || (nbuf = realloc(l->buf, size)) == NULL) {
+			/* too much at once or no memory: write it right away */
+			if (logfdrain(l, l->len) || logfputs(l, buf, n))
+				return -1;
+			changed_logfile(l);
+			logfdrainindex(l);
+			return 1;
+		}
+		l->buf = nbuf;
+		l->size = size;
+	}
+	memcpy(l->buf + l->len, buf, n);
+	l->len += n;
+	if (logrotate_size && l->st->st_size + (off_t)(l->len - l->off) >= logrotate_size)
+		logrotate_due(l);
+	if (l->len - l->off >= LOGBUF_WRITE && !logwriteev.queued) {
+		SetTimeout(&logwriteev, 0);
+		evenq(&logwriteev);
+	}
+	return 1;
+}
+
+bool logffull(Log *l, size_t n)
+{
+	return l->len - l->off + n > LOGBUF_MAX;
+}
+
+off_t logftell(Log *l)
+{
+	return l->st->st_size + (off_t)(l->len - l->off);
+}
+
+int logfindex(Log *l, char *buf, size_t n)
+{
+	char *nbuf;
+
+	if (!buf) {
+		if (l->idxfd >= 0)
+			close(l->idxfd);
+		l->idxfd = -1;
+		l->idxtrunc = true;
+		l->ilen = 0;
+		return 0;
+	}
+	if ((nbuf = realloc(l->ibuf, l->ilen + n)) == NULL)
+		return -1;
+	l->ibuf = nbuf;
+	memcpy(l->ibuf + l->ilen, buf, n);
+	l->ilen += n;
+	return 0;
 }
 
 int logfflush(Log *l)
@@ -221,15 +417,165 @@ int logfflush(Log *l)
 		for (l = logroot; l; l = l->next) {
 			if (stolen_logfile(l) && logfile_reopen(l->name, fileno(l->fp), l))
 				return -1;
-			r |= fflush(l->fp);
+			r |= logfdrain(l, l->len);
 			l->flushcount++;
-			changed_logfile(l);
+			if (logrotate_interval && time(NULL) - l->since >= logrotate_interval)
+				logrotate_due(l);
 	} else {
 		if (stolen_logfile(l) && logfile_reopen(l->name, fileno(l->fp), l))
 			return -1;
-		r = fflush(l->fp);
+		r = logfdrain(l, l->len);
 		l->flushcount++;
-		changed_logfile(l);
+		if (logrotate_interval && time(NULL) - l->since >= logrotate_interval)
+			logrotate_due(l);
 	}
 	return r;
 }
+
+void logfrotate(Log *l)
+{
+	if (!l)
+		for (l = logroot; l; l = l->next) {
+			l->rotwait = 0;
+			logrotate_due(l);
+		}
+	else {
+		l->rotwait = 0;
+		logrotate_due(l);
+	}
+}
+
+/*
+ * Rotation renames files and may fork, which is nothing to do in the
+ * middle of the emulator's output, so it is left to logwrite_fn.
+ */
+static void logrotate_due(Log *l)
+{
+	if (l->rotate || (l->rotwait && time(NULL) < l->rotwait))
+		return;
+	l->rotate = true;
+	if (!logwriteev.queued) {
+		SetTimeout(&logwriteev, 0);
+		evenq(&logwriteev);
+	}
+}
+
+/*
+ * Moves the file aside and opens a new one on the same descriptor. If
+ * the new file can't be created the old one is put back and used on.
+ * Both are done as the real user, like opening the log in the first
+ * place. Only a failure to write out the pending output is returned,
+ * the log can't go on after that.
+ */
+static int logrotate_now(Log *l)
+{
+	char seg[MAXPATHLEN];
+	struct stat st;
+	struct tm *tm;
+	time_t now = time(NULL);
+	size_t len;
+	int fd = -1, err = 0;
+
+	l->rotate = false;
+	if (!l->st->st_size && l->len == l->off) {
+		l->since = now;
+		return 0;	/* nothing to rotate */
+	}
+	if (logfdrain(l, l->len))
+		return -1;
+	if (snprintf(seg, sizeof(seg) - 16, "%s.", l->name) >= (int)sizeof(seg) - 16)
+		return logrotate_failed(l, ENAMETOOLONG);
+	len = strlen(seg);
+	tm = localtime(&now);
+	strftime(seg + len, sizeof(seg) - 16 - len, "%Y%m%d-%H%M%S", tm);
+	len = strlen(seg);
+
+	/* the compressor may have taken the name of the last one already */
+	l->rotseq = l->since == now ? l->rotseq + 1 : 0;
+	l->since = now;
+	if (l->rotseq)
+		sprintf(seg + len, ".%d", l->rotseq);
+
+	xseteuid(real_uid);
+	xsetegid(real_gid);
+	for (int i = l->rotseq + 1; lstat(seg, &st) == 0 && i < 1000; i++)
+		sprintf(seg + len, ".%d", l->rotseq = i);
+	if (rename(l->name, seg))
+		err = errno;
+	else if ((fd = open(l->name, O_WRONLY | O_CREAT | O_APPEND, 0666)) < 0) {
+		err = errno;
+		rename(seg, l->name);
+	} else if (l->timed) {
+		char from[MAXPATHLEN + 4], to[MAXPATHLEN + 4];
+
+		/* the index goes along with the output it indexes */
+		sprintf(from, "%s.idx", l->name);
+		sprintf(to, "%s.idx", seg);
+		rename(from, to);
+	}
+	xseteuid(eff_uid);
+	xsetegid(eff_gid);
+	if (fd < 0)
+		return logrotate_failed(l, err);
+
+	if (dup2(fd, fileno(l->fp)) < 0) {
+		err = errno;
+		close(fd);
+		xseteuid(real_uid);
+		xsetegid(real_gid);
+		rename(seg, l->name);
+		xseteuid(eff_uid);
+		xsetegid(eff_gid);
+		return logrotate_failed(l, err);
+	}
+	close(fd);
+	memset(l->st, 0, sizeof(struct stat));
+	if (l->idxfd >= 0)
+		close(l->idxfd);
+	l->idxfd = -1;
+	l->gen = ++loggen;
+	if (logrotate_compress)
+		logcompress(seg);
+	return 0;
+}
+
+/* Keeps the log going to the old file and retries later */
+static int logrotate_failed(Log *l, int err)
+{
+	Msg(err, "%s: cannot rotate logfile", l->name);
+	l->rotwait = time(NULL) + LOGROTATE_RETRY;
+	return 0;
+}
+
+/*
+ * Runs logrotate_compress on a rotated file in a child of its own, so
+ * that the main loop never waits for it. DoWait() reaps it.
+ */
+static void logcompress(char *seg)
+{
+	char *cmd;
+
+	if ((cmd = malloc(strlen(logrotate_compress) + 8)) == NULL)
+		return;
+	sprintf(cmd, "%s \"$1\"", logrotate_compress);
+	switch (fork()) {
+	case -1:
+		break;
+	case 0:
+		displays = NULL;
+		ServerSocket = -1;
+		closeallfiles(0);
+		if (setgid(real_gid) || setuid(real_uid))
+			Panic(errno, "logcompress setuid");
+		eff_uid = real_uid;
+		eff_gid = real_gid;
+#ifdef SIGPIPE
+		xsignal(SIGPIPE, SIG_DFL);
+#endif
+		execl("/bin/sh", "sh", "-c", cmd, "sh", seg, NULL);
+		Panic(errno, "/bin/sh");
+	default:
+		break;
+	}
+	free(cmd);
+}
@@ -30,7 +30,10 @@
 #ifndef SCREEN_LOGFILE_H
 #define SCREEN_LOGFILE_H
 
+#include <stdbool.h>
 #include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
 
 typedef struct Log Log;
 struct Log {
@@ -41,8 +44,32 @@ struct Log {
 	int writecount;	/* increments at logfwrite(), counts write() and fflush() */
 	int flushcount;	/* increments at logfflush(), zeroed at logfwrite() */
 	struct stat *st;/* how the file looks like */
+	char *buf;	/* output not written yet is buf[off] to buf[len - 1] */
+	size_t off;
+	size_t len;
+	size_t size;
+	int error;	/* errno of a failed write from the main loop */
+	time_t since;	/* when the file was opened or last rotated */
+	bool rotate;	/* due for rotation, done from the main loop */
+	int rotseq;	/* rotations within the second of since */
+	time_t rotwait;	/* no automatic rotation before, after a failed one */
+	bool timed;	/* records and an index instead of raw output */
+	unsigned gen;	/* changes whenever a new file is started */
+	int idxfd;	/* name.idx, opened when first written */
+	bool idxtrunc;	/* the index starts over with the next entry */
+	char *ibuf;	/* index entries waiting for the output before them */
+	size_t ilen;
 };
 
+#define LOGBUF_WRITE	(64 * 1024)	/* written per main loop round */
+#define LOGBUF_MAX	(1024 * 1024)	/* beyond this logfwrite waits */
+#define LOGWRITE_MS	20		/* time for writing per main loop round */
+#define LOGROTATE_RETRY	60		/* seconds until a failed rotation is retried */
+
+extern off_t logrotate_size;		/* rotate at this size, 0 never */
+extern int logrotate_interval;		/* rotate after seconds, 0 never */
+extern char *logrotate_compress;	/* run on rotated files, or NULL */
+
 /*
  * open a logfile, The second argument must be NULL, when the named file
  * is already a logfile or must be a appropriatly opened file pointer
@@ -62,7 +89,26 @@ int islogfile (char *name);
  * logfclose does free()
  */
 int logfclose (Log *);
+
+/*
+ * logfwrite only buffers. Once LOGBUF_WRITE bytes are pending they are
+ * written from the main loop in slices of that size, for at most
+ * LOGWRITE_MS per round; logfflush writes everything. If more than
+ * LOGBUF_MAX would be pending, logfwrite writes it out before it
+ * returns; logffull tells whether writing n bytes would have to wait
+ * for the file like that.
+ */
 int logfwrite (Log *, char *, size_t);
+bool logffull (Log *, size_t n);
+
+/*
+ * logftell returns the offset the next logfwrite ends up at.
+ * logfindex adds an entry to the index file, which is written out
+ * once the output before it has been; a NULL buf starts the index
+ * over, for a log that starts a new file.
+ */
+off_t logftell (Log *);
+int logfindex (Log *, char *buf, size_t n);
 
 /*
  * logfflush should be called periodically. If no argument is passed,
@@ -71,6 +117,16 @@ int logfwrite (Log *, char *, size_t);
  */
 int logfflush (Log *ifany);
 
+/*
+ * logfrotate renames the file to name.YYYYmmdd-HHMMSS and starts a new
+ * one under the old name, from the main loop and not right away.
+ * Without argument all logfiles are rotated. logfwrite and logfflush
+ * do the same once logrotate_size or logrotate_interval is reached.
+ * If the rotation fails, this is reported and logging goes on to the
+ * old file; it is tried again after LOGROTATE_RETRY seconds.
+ */
+void logfrotate (Log *ifany);
+
 /*
  * Your custom reopen function is required to reuse the exact
  * filedescriptor.
@@ -158,6 +158,12 @@ typedef char* slot_t;	/* used internally in utmp.c */
  */
 #define IOSIZE		4096
 
+/*
+ * Window pty reads start at IOSIZE and grow up to this size while the
+ * pty keeps filling the buffer, see win_readev_fn().
+ */
+#define IOSIZE_MAX	(256 * 1024)
+
 /* Changing those you won't be able to attach to your old sessions
  * when changing those values in official tree don't forget to bump
  * MSG_VERSION */
@@ -36,6 +36,7 @@
 #include "process.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -1053,6 +1054,20 @@ static void DoCommandLog(struct action *act)
 		LogToggle(b);
 }
 
+static void DoCommandDeflognonblock(struct action *act)
+{
+	(void)ParseOnOff(act, &deflognonblock);
+}
+
+static void DoCommandLognonblock(struct action *act)
+{
+	int msgok = display && !*rc_name;
+
+	if (ParseSwitch(act, &fore->w_lognonblock) == 0 && msgok)
+		OutputMsg(0, "Log output %s when the logfile lags behind",
+			  fore->w_lognonblock ? "dropped" : "waited for");
+}
+
 
 static void DoCommandSuspend(struct action *act)
 {
@@ -2100,6 +2115,39 @@ static void DoCommandDisplays(struct action *act)
 	display_displays();
 }
 
+static void DoCommandDisplayfps(struct action *act)
+{
+	char **args = act->args;
+	int msgok = display && !*rc_name;
+	int n;
+
+	if (*args) {
+		if (!strcmp(*args, "off"))
+			n = 0;
+		else if (ParseNum(act, &n))
+			return;
+		if (n < 0 || n > 1000) {
+			OutputMsg(0, "%s: displayfps: frame rate must be between 0 and 1000", rc_name);
+			return;
+		}
+		displayfps = n;
+	}
+	if (msgok) {
+		if (displayfps == 0)
+			OutputMsg(0, "updating displays immediately");
+		else
+			OutputMsg(0, "updating displays at most %d times per second", displayfps);
+	}
+}
+
+static void DoCommandPassthrough(struct action *act)
+{
+	int msgok = display && !*rc_name;
+
+	if (ParseSwitch(act, &passthrough) == 0 && msgok)
+		OutputMsg(0, "passthrough turned %s", passthrough ? "on" : "off");
+}
+
 static void DoCommandWindowlist(struct action *act)
 {
 	char **args = act->args;
@@ -2613,10 +2661,19 @@ static void DoCommandLogfile(struct action *act)
 				OutputMsg(0, "log flush timeout set to %ds\n", log_flush);
 			return;
 		}
+		if (args[1] && !(strcmp(*args, "format"))) {
+			if (!strcmp(args[1], "timed") || !strcmp(args[1], "raw"))
+				log_timed = !strcmp(args[1], "timed");
+			else
+				OutputMsg(0, "%s: logfile format: use raw or timed", rc_name);
+			if (msgok)
+				OutputMsg(0, "new logfiles are %s\n", log_timed ? "timed" : "raw");
+			return;
+		}
 		if (ParseSaveStr(act, &screenlogfile))
 			return;
 		if (fore && fore->w_log)
-			if (DoStartLog(fore, buf, ARRAY_SIZE(buf)))
+			if (DoStartLog(fore, buf, ARRAY_SIZE(buf)) == -2)
 				OutputMsg(0, "Error opening logfile \"%s\"", buf);
 		if (!msgok)
 			return;
@@ -2651,6 +2708,74 @@ static void DoCommandLogtstamp(struct action *act)
 		OutputMsg(0, "usage: logtstamp [after [n]|string [str]|on|off]");
 }
 
+static void DoCommandLogrotate(struct action *act)
+{
+	char **args = act->args;
+	int msgok = display && !*rc_name;
+
+	if (!*args) {
+		logfrotate(NULL);
+		if (msgok)
+			OutputMsg(0, "logfiles rotated");
+	} else if (!strcmp(*args, "size")) {
+		if (args[1]) {
+			char *p = "";
+			long long size = 0;
+			int shift = 0;
+
+			errno = 0;
+			if (strcmp(args[1], "off"))
+				size = strtoll(args[1], &p, 10);
+			if (*p == 'k' || *p == 'K')
+				shift = 10, p++;
+			else if (*p == 'm' || *p == 'M')
+				shift = 20, p++;
+			else if (*p == 'g' || *p == 'G')
+				shift = 30, p++;
+			if (*p || errno == ERANGE || size < 0 || size > (LLONG_MAX >> shift) ||
+			    (off_t)(size << shift) != (size << shift) || p == args[1]) {
+				OutputMsg(0, "%s: logrotate size: invalid argument %s", rc_name, args[1]);
+				return;
+			}
+			logrotate_size = size << shift;
+			if (!msgok)
+				return;
+		}
+		if (logrotate_size)
+			OutputMsg(0, "logfiles rotated at %lld bytes", (long long)logrotate_size);
+		else
+			OutputMsg(0, "logfiles not rotated by size");
+	} else if (!strcmp(*args, "interval")) {
+		if (args[1]) {
+			char *p = "";
+			long secs = 0;
+
+			if (strcmp(args[1], "off"))
+				secs = strtol(args[1], &p, 10);
+			if (*p || secs < 0 || secs > INT_MAX || p == args[1]) {
+				OutputMsg(0, "%s: logrotate interval: invalid argument %s", rc_name, args[1]);
+				return;
+			}
+			logrotate_interval = secs;
+			if (!msgok)
+				return;
+		}
+		if (logrotate_interval)
+			OutputMsg(0, "logfiles rotated every %ds", logrotate_interval);
+		else
+			OutputMsg(0, "logfiles not rotated by time");
+	} else if (!strcmp(*args, "compress")) {
+		if (args[1]) {
+			free(logrotate_compress);
+			logrotate_compress = strcmp(args[1], "off") ? SaveStr(args[1]) : NULL;
+			if (!msgok)
+				return;
+		}
+		OutputMsg(0, "rotated logfiles compressed with '%s'", logrotate_compress ? logrotate_compress : "<nothing>");
+	} else
+		OutputMsg(0, "usage: logrotate [size [n[k|m|g]|off]|interval [secs|off]|compress [cmd|off]]");
+}
+
 static void DoCommandShelltitle(struct action *act)
 {
 	(void)ParseSaveStr(act, &nwin_default.aka);
@@ -3395,6 +3520,31 @@ static void DoCommandCompacthist(struct action *act)
 		OutputMsg(0, "%scompacting history lines", compacthist ? "" : "not ");
 }
 
+static void DoCommandCompresshist(struct action *act)
+{
+	char **args = act->args;
+	int msgok = display && !*rc_name;
+	int n;
+
+	if (*args) {
+		if (!strcmp(*args, "off"))
+			n = -1;
+		else if (ParseNum(act, &n))
+			return;
+		compresshist = n;
+		for (Window *win = mru_window; win; win = win->w_prev_mru) {
+			sb_unpackall(win);
+			sb_packall(win);
+		}
+	}
+	if (msgok) {
+		if (compresshist < 0)
+			OutputMsg(0, "not compressing history lines");
+		else
+			OutputMsg(0, "compressing history lines beyond %d", compresshist);
+	}
+}
+
 static void DoCommandHardcopy_append(struct action *act)
 {
 	(void)ParseOnOff(act, &hardcopy_append);
@@ -4745,6 +4895,12 @@ void DoAction(struct action *act)
 	case RC_LOG:
 		DoCommandLog(act);
 		break;
+	case RC_DEFLOGNONBLOCK:
+		DoCommandDeflognonblock(act);
+		break;
+	case RC_LOGNONBLOCK:
+		DoCommandLognonblock(act);
+		break;
 	case RC_SUSPEND:
 		DoCommandSuspend(act);
 		break;
@@ -4887,6 +5043,12 @@ void DoAction(struct action *act)
 	case RC_DISPLAYS:
 		DoCommandDisplays(act);
 		break;
+	case RC_DISPLAYFPS:
+		DoCommandDisplayfps(act);
+		break;
+	case RC_PASSTHROUGH:
+		DoCommandPassthrough(act);
+		break;
 	case RC_WINDOWLIST:
 		DoCommandWindowlist(act);
 		break;
@@ -4939,6 +5101,9 @@ void DoAction(struct action *act)
 	case RC_LOGTSTAMP:
 		DoCommandLogtstamp(act);
 		break;
+	case RC_LOGROTATE:
+		DoCommandLogrotate(act);
+		break;
 	case RC_SHELLTITLE:
 		DoCommandShelltitle(act);
 		break;
@@ -5094,6 +5259,9 @@ void DoAction(struct action *act)
 	case RC_COMPACTHIST:
 		DoCommandCompacthist(act);
 		break;
+	case RC_COMPRESSHIST:
+		DoCommandCompresshist(act);
+		break;
 	case RC_HARDCOPY_APPEND:
 		DoCommandHardcopy_append(act);
 		break;
@@ -5933,6 +6101,7 @@ void KillWindow(Window *window)
 			if (window->w_zdisplay == display) {
 				D_blocked = 0;
 				D_readev.condpos = D_readev.condneg = NULL;
+				evgate(&D_readev);
 			}
 			Activate(-1);
 		}
@@ -5951,6 +6120,7 @@ void KillWindow(Window *window)
 static void LogToggle(bool on)
 {
 	char buf[1024];
+	int n;
 
 	if ((fore->w_log != NULL) == on) {
 		if (display && !*rc_name)
@@ -5964,8 +6134,9 @@ static void LogToggle(bool on)
 		WindowChanged(fore, WINESC_WFLAGS);
 		return;
 	}
-	if (DoStartLog(fore, buf, ARRAY_SIZE(buf))) {
-		Msg(errno, "Error opening logfile \"%s\"", buf);
+	if ((n = DoStartLog(fore, buf, ARRAY_SIZE(buf)))) {
+		if (n == -2)
+			Msg(errno, "Error opening logfile \"%s\"", buf);
 		return;
 	}
 	if (ftell(fore->w_log->fp) == 0)
@@ -6198,6 +6369,12 @@ static void ShowInfo(void)
 		sprintf(p += strlen(p), " -c1");
 	if (wp->w_norefresh)
 		sprintf(p += strlen(p), " nored");
+	sprintf(p += strlen(p), " rbuf:%zuk", wp->w_readsize / 1024);
+	if (wp->w_pages.npages) {
+		size_t packed, raw;
+		sb_packstats(wp, &packed, &raw);
+		sprintf(p += strlen(p), " hist:%zuk/%zuk", packed / 1024, raw / 1024);
+	}
 
 	p += strlen(p);
 	if (wp->w_encoding && (display == NULL || D_encoding != wp->w_encoding || EncodingDefFont(wp->w_encoding) <= 0)) {
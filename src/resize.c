@@ -55,11 +55,9 @@ static void SwapAltScreen(Window *);
 struct winsize glwz;
 
 static struct mline mline_zero = {
-	.image   = NULL,
-	.attr    = NULL,
-	.font    = NULL,
-	.colorbg = NULL,
-	.colorfg = NULL
+	.image = NULL,
+	.font  = NULL,
+	.rend  = NULL
 };
 
 /*
@@ -123,6 +121,7 @@ void ChangeScreenSize(int wi, int he, int change_fore)
 
 	D_width = wi;
 	D_height = he;
+	ForgetShadow();
 
 	CheckMaxSize(wi);
 	if (D_CWS) {
@@ -306,24 +305,18 @@ static void FreeMline(struct mline *ml)
 {
 	if (ml->image)
 		free(ml->image);
-	if (ml->attr && ml->attr != null)
-		free(ml->attr);
-	if (ml->font && ml->font != null)
+	if (ml->font && ml->font != null16)
 		free(ml->font);
-	if (ml->colorbg && ml->colorbg != null)
-		free(ml->colorbg);
-	if (ml->colorfg && ml->colorfg != null)
-		free(ml->colorfg);
+	if (ml->rend && ml->rend != null16)
+		free(ml->rend);
 	*ml = mline_zero;
 }
 
 static int AllocMline(struct mline *ml, int w)
 {
 	ml->image = malloc(w * 4);
-	ml->attr = null;
-	ml->font = null;
-	ml->colorbg = null;
-	ml->colorfg = null;
+	ml->font = null16;
+	ml->rend = null16;
 	if (ml->image == NULL)
 		return -1;
 	return 0;
@@ -334,30 +327,18 @@ static int BcopyMline(struct mline *mlf, int xf, struct mline *mlt, int xt, int
 	int r = 0;
 
 	memmove(mlt->image + xt, mlf->image + xf, l * 4);
-	if (mlf->attr != null && mlt->attr == null) {
-		if ((mlt->attr = calloc(w, 4)) == NULL)
-			mlt->attr = null, r = -1;
-	}
-	if (mlt->attr != null)
-		memmove(mlt->attr + xt, mlf->attr + xf, l * 4);
-	if (mlf->font != null && mlt->font == null) {
-		if ((mlt->font = calloc(w, 4)) == NULL)
-			mlt->font = null, r = -1;
-	}
-	if (mlt->font != null)
-		memmove(mlt->font + xt, mlf->font + xf, l * 4);
-	if (mlf->colorbg != null && mlt->colorbg == null) {
-		if ((mlt->colorbg = calloc(w, 4)) == NULL)
-			mlt->colorbg = null, r = -1;
-	}
-	if (mlt->colorbg != null)
-		memmove(mlt->colorbg + xt, mlf->colorbg + xf, l * 4);
-	if (mlf->colorfg != null && mlt->colorfg == null) {
-		if ((mlt->colorfg = calloc(w, 4)) == NULL)
-			mlt->colorfg = null, r = -1;
-	}
-	if (mlt->colorfg != null)
-		memmove(mlt->colorfg + xt, mlf->colorfg + xf, l * 4);
+	if (mlf->font != null16 && mlt->font == null16) {
+		if ((mlt->font = calloc(w, 2)) == NULL)
+			mlt->font = null16, r = -1;
+	}
+	if (mlt->font != null16)
+		memmove(mlt->font + xt, mlf->font + xf, l * 2);
+	if (mlf->rend != null16 && mlt->rend == null16) {
+		if ((mlt->rend = calloc(w, 2)) == NULL)
+			mlt->rend = null16, r = -1;
+	}
+	if (mlt->rend != null16)
+		memmove(mlt->rend + xt, mlf->rend + xf, l * 2);
 	return r;
 }
 
@@ -365,7 +346,7 @@ static int maxwidth;
 
 static void CheckMaxSize(int wi)
 {
-	uint32_t *oldnull = null;
+	uint16_t *oldnull16 = null16;
 	uint32_t *oldblank = blank;
 	Window *p;
 	int i;
@@ -378,27 +359,23 @@ static void CheckMaxSize(int wi)
 	maxwidth = wi + 1;
 	blank = xrealloc(blank, maxwidth * 4);
 	null = xrealloc(null, maxwidth * 4);
+	null16 = xrealloc(null16, maxwidth * 2);
 	mline_old.image = xrealloc(mline_old.image, maxwidth * 4);
-	mline_old.attr = xrealloc(mline_old.attr, maxwidth * 4);
-	mline_old.font = xrealloc(mline_old.font, maxwidth * 4);
-	mline_old.colorbg = xrealloc(mline_old.colorbg, maxwidth * 4);
-	mline_old.colorfg = xrealloc(mline_old.colorfg, maxwidth * 4);
-	if (!(blank && null && mline_old.image && mline_old.attr && mline_old.font && mline_old.colorbg && mline_old.colorfg))
+	mline_old.font = xrealloc(mline_old.font, maxwidth * 2);
+	mline_old.rend = xrealloc(mline_old.rend, maxwidth * 2);
+	if (!(blank && null && null16 && mline_old.image && mline_old.font && mline_old.rend))
 		Panic(0, "%s", strnomem);
 
 	MakeBlankLine(blank, maxwidth);
 	memset(null, 0, maxwidth * 4);
+	memset(null16, 0, maxwidth * 2);
 
 	mline_blank.image = blank;
-	mline_blank.attr = null;
 	mline_null.image = null;
-	mline_null.attr = null;
-	mline_blank.font = null;
-	mline_null.font = null;
-	mline_blank.colorbg = null;
-	mline_null.colorbg = null;
-	mline_blank.colorfg = null;
-	mline_null.colorfg = null;
+	mline_blank.font = null16;
+	mline_null.font = null16;
+	mline_blank.rend = null16;
+	mline_null.rend = null16;
 
 #define RESET_AFC(x, bl)	\
 do {				\
@@ -411,10 +388,8 @@ do {						\
 	ml = lines;				\
 	for (i = 0; i < count; i++, ml++) {	\
 		RESET_AFC(ml->image, blank);	\
-		RESET_AFC(ml->attr, null);	\
-		RESET_AFC(ml->font, null);	\
-		RESET_AFC(ml->colorbg, null);	\
-		RESET_AFC(ml->colorfg, null);	\
+		RESET_AFC(ml->font, null16);	\
+		RESET_AFC(ml->rend, null16);	\
 	}					\
 } while (0)
 
@@ -484,6 +459,17 @@ int ChangeWindowSize(Window *p, int wi, int he, int hi)
 
 	CheckMaxSize(wi);
 
+	/* the history is rebuilt from unpacked lines with private planes */
+	if (wi)
+		sb_unpackall(p);
+	else
+		sb_freepages(&p->w_pages);
+	if (!p->w_sb.thawed) {
+		for (y = 0; y < p->w_histheight; y++)
+			sb_thaw(&p->w_sb, &p->w_hlines[y]);
+		p->w_sb.thawed = true;
+	}
+
 	fy = p->w_histheight + p->w_height - 1;
 	ty = hi + he - 1;
 
@@ -570,7 +556,7 @@ int ChangeWindowSize(Window *p, int wi, int he, int hi)
 
 		/* calculate lenght */
 		for (l = p->w_width - 1; l > 0; l--)
-			if (mlf->image[l] != ' ' || mlf->attr[l])
+			if (mlf->image[l] != ' ' || mlf->rend[l])
 				break;
 		if (fy == p->w_y + p->w_histheight && l < p->w_x)
 			l = p->w_x;	/* cursor is non blank */
@@ -726,6 +712,10 @@ int ChangeWindowSize(Window *p, int wi, int he, int hi)
 		p->w_scrollback_height = hi;
 	p->w_histidx = 0;
 	p->w_histheight = hi;
+	for (y = 0; y < hi; y++)
+		sb_freeze(&p->w_sb, &p->w_hlines[y], wi + 1);
+	p->w_sb.thawed = false;
+	sb_packall(p);
 
 #ifdef ENABLE_TELNET
 	if (p->w_type == W_TYPE_TELNET)
@@ -763,10 +753,13 @@ void FreeAltScreen(Window *p)
 	p->w_alt.width = 0;
 	p->w_alt.height = 0;
 	if (p->w_alt.hlines) {
-		for (i = 0; i < p->w_alt.histheight; i++)
+		for (i = 0; i < p->w_alt.histheight; i++) {
+			sb_release(&p->w_sb, p->w_alt.hlines + i);
 			FreeMline(p->w_alt.hlines + i);
+		}
 		free(p->w_alt.hlines);
 	}
+	sb_freepages(&p->w_alt.pages);
 	p->w_alt.hlines = NULL;
 	p->w_alt.histidx = 0;
 	p->w_alt.histheight = 0;
@@ -775,6 +768,7 @@ void FreeAltScreen(Window *p)
 static void SwapAltScreen(Window *p)
 {
 	struct mline *ml;
+	SbPages pages;
 	int t;
 
 #define SWAP(item, t)			\
@@ -791,6 +785,7 @@ do {					\
 	SWAP(histheight, t);
 	SWAP(hlines, ml);
 	SWAP(histidx, t);
+	SWAP(pages, pages);
 #undef SWAP
 }
 
@@ -30,53 +30,440 @@
 
 #include "sched.h"
 
+#include <limits.h>
 #include <poll.h>
 #include <stdint.h>
 #include <sys/types.h>
 #include <time.h>
-#include <sys/time.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include "screen.h"
 
-static Event *evs;
-static Event *tevs;
+/*
+ * File descriptors stay registered with the kernel for as long as an
+ * event is queued on them. Ungated events are armed when they are
+ * queued; only events with a condpos/condneg gate are kept on a list
+ * whose gates every pass of sched() re-evaluates. Code that sets a gate
+ * on a queued event calls evgate(). The fds whose interest actually
+ * changed are handed to the backend (epoll if available, a persistent
+ * pollfd array otherwise).
+ */
+
+typedef struct FdSlot FdSlot;
+struct FdSlot {
+	Event *evs;		/* events queued on this fd */
+	short mask;		/* interest registered with the backend */
+	bool dirty;		/* mask has to be recomputed */
+	int pidx;		/* index into pfd, -1 if not polled */
+};
+
+#define EV_ERRMASK	(POLLERR | POLLHUP | POLLNVAL)
+
+static Event *gevs;		/* gated EV_READ and EV_WRITE events */
+static Event *aevs;		/* EV_ALWAYS events */
 static Event *nextev;
-static int calctimeout;
+
+static FdSlot *fds;
+static int fds_cnt;
+static int *dirtyfds;
+static int dirty_cnt;
+static int dirty_max;
+
+/* EV_TIMEOUT events, binary min-heap ordered by expiry */
+static Event **theap;
+static int theap_cnt;
+static int theap_max;
+
+static Event **ready;
+static int ready_cnt;
+static int ready_max;
+
 static struct pollfd *pfd;
 static int pfd_cnt;
+static int pfd_max;
 
+#ifdef HAVE_SYS_EPOLL_H
+#define EPOLL_BATCH	64
+static int epfd = -1;
+#endif
 
-static Event *calctimo(void);
+static void usepoll(void);
 
-void evenq(Event *ev)
+static inline bool evactive(Event *ev)
+{
+	return !ev->condpos || *ev->condpos > (ev->condneg ? *ev->condneg : 0);
+}
+
+static inline short evmask(Event *ev)
+{
+	return ev->type == EV_READ ? POLLIN : POLLOUT;
+}
+
+static FdSlot *getslot(int fd)
+{
+	if (fd >= fds_cnt) {
+		int n = fds_cnt ? fds_cnt : 16;
+		while (n <= fd)
+			n *= 2;
+		fds = realloc(fds, n * sizeof(FdSlot));
+		if (!fds)
+			Panic(0, "%s", strnomem);
+		memset(fds + fds_cnt, 0, (n - fds_cnt) * sizeof(FdSlot));
+		for (int i = fds_cnt; i < n; i++)
+			fds[i].pidx = -1;
+		fds_cnt = n;
+	}
+	return &fds[fd];
+}
+
+static void markdirty(int fd)
+{
+	FdSlot *slot;
+
+	if (fd < 0)
+		return;
+	slot = getslot(fd);
+	if (slot->dirty)
+		return;
+	if (dirty_cnt == dirty_max) {
+		dirty_max = dirty_max ? dirty_max * 2 : 16;
+		dirtyfds = realloc(dirtyfds, dirty_max * sizeof(int));
+		if (!dirtyfds)
+			Panic(0, "%s", strnomem);
+	}
+	dirtyfds[dirty_cnt++] = fd;
+	slot->dirty = true;
+}
+
+/* poll backend: keep one pollfd per registered fd, updated in place */
+static void pollset(int fd, FdSlot *slot, short mask)
+{
+	if (!mask) {
+		if (slot->pidx >= 0) {
+			pfd[slot->pidx] = pfd[--pfd_cnt];
+			if (slot->pidx < pfd_cnt)
+				fds[pfd[slot->pidx].fd].pidx = slot->pidx;
+			slot->pidx = -1;
+		}
+		return;
+	}
+	if (slot->pidx < 0) {
+		if (pfd_cnt == pfd_max) {
+			pfd_max = pfd_max ? pfd_max * 2 : 16;
+			pfd = realloc(pfd, pfd_max * sizeof(struct pollfd));
+			if (!pfd)
+				Panic(0, "%s", strnomem);
+		}
+		slot->pidx = pfd_cnt++;
+		pfd[slot->pidx].fd = fd;
+	}
+	pfd[slot->pidx].events = mask;
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static void epollset(int fd, FdSlot *slot, short mask)
+{
+	struct epoll_event e;
+
+	memset(&e, 0, sizeof(e));
+	e.events = (mask & POLLIN ? EPOLLIN : 0) | (mask & POLLOUT ? EPOLLOUT : 0);
+	e.data.fd = fd;
+
+	if (!mask) {
+		/* may already be gone if the fd got closed, ignore errors */
+		epoll_ctl(epfd, EPOLL_CTL_DEL, fd, &e);
+		return;
+	}
+	if (!slot->mask) {
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) == 0)
+			return;
+		if (errno == EEXIST && epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e) == 0)
+			return;
+	} else {
+		if (epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e) == 0)
+			return;
+		if (errno == ENOENT && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &e) == 0)
+			return;
+	}
+	/* fd not supported by epoll (e.g. a regular file), poll() copes;
+	 * usepoll() only knows the old mask of this fd */
+	usepoll();
+	pollset(fd, slot, mask);
+}
+#endif
+
+static void backendset(int fd, FdSlot *slot, short mask)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0)
+		epollset(fd, slot, mask);
+	else
+#endif
+		pollset(fd, slot, mask);
+	slot->mask = mask;
+}
+
+/* switch to the poll backend, carrying over all registered fds */
+static void usepoll(void)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0) {
+		close(epfd);
+		epfd = -1;
+	}
+#endif
+	for (int fd = 0; fd < fds_cnt; fd++)
+		if (fds[fd].mask)
+			pollset(fd, &fds[fd], fds[fd].mask);
+}
+
+static void syncfds(void)
+{
+	for (int i = 0; i < dirty_cnt; i++) {
+		int fd = dirtyfds[i];
+		FdSlot *slot = &fds[fd];
+		short mask = 0;
+
+		slot->dirty = false;
+		for (Event *ev = slot->evs; ev; ev = ev->fdnext)
+			if (ev->armed)
+				mask |= evmask(ev);
+		if (mask != slot->mask)
+			backendset(fd, slot, mask);
+	}
+	dirty_cnt = 0;
+}
+
+/* queue all armed events on fd that are affected by revents, by priority */
+static void addready(int fd, short revents)
+{
+	for (Event *ev = fds[fd].evs; ev; ev = ev->fdnext) {
+		int i;
+
+		if (!ev->armed || ev->pending || !(revents & (evmask(ev) | EV_ERRMASK)))
+			continue;
+		if (ready_cnt == ready_max) {
+			ready_max = ready_max ? ready_max * 2 : 16;
+			ready = realloc(ready, ready_max * sizeof(Event *));
+			if (!ready)
+				Panic(0, "%s", strnomem);
+		}
+		for (i = ready_cnt++; i > 0 && ready[i - 1]->priority < ev->priority; i--)
+			ready[i] = ready[i - 1];
+		ready[i] = ev;
+		ev->pending = true;
+	}
+}
+
+/* wait for fd readiness, returns number of ready fds like poll() */
+static int waitfds(int timeout)
+{
+	int n;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if (epfd >= 0) {
+		struct epoll_event e[EPOLL_BATCH];
+
+		n = epoll_wait(epfd, e, EPOLL_BATCH, timeout);
+		for (int i = 0; i < n; i++) {
+			short revents = 0;
+			if (e[i].events & EPOLLIN)
+				revents |= POLLIN;
+			if (e[i].events & EPOLLOUT)
+				revents |= POLLOUT;
+			if (e[i].events & EPOLLERR)
+				revents |= POLLERR;
+			if (e[i].events & EPOLLHUP)
+				revents |= POLLHUP;
+			addready(e[i].data.fd, revents);
+		}
+		return n;
+	}
+#endif
+	n = poll(pfd, pfd_cnt, timeout);
+	for (int i = 0, left = n; i < pfd_cnt && left > 0; i++)
+		if (pfd[i].revents) {
+			addready(pfd[i].fd, pfd[i].revents);
+			left--;
+		}
+	return n;
+}
+
+static void unlink_fd(Event *ev)
+{
+	FdSlot *slot;
+	Event **evpp;
+
+	if (ev->fd < 0 || ev->fd >= fds_cnt)
+		return;
+	slot = &fds[ev->fd];
+	for (evpp = &slot->evs; *evpp; evpp = &(*evpp)->fdnext)
+		if (*evpp == ev) {
+			*evpp = ev->fdnext;
+			break;
+		}
+	if (!slot->evs) {
+		/* fd is about to be closed, forget it right away so that a
+		 * new fd with the same number starts from a clean state */
+		if (slot->mask)
+			backendset(ev->fd, slot, 0);
+	} else if (ev->armed)
+		markdirty(ev->fd);
+	ev->armed = false;
+
+	if (ev->pending) {
+		for (int i = 0; i < ready_cnt; i++)
+			if (ready[i] == ev)
+				ready[i] = NULL;
+		ev->pending = false;
+	}
+}
+
+int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* a fires before b; ties go to the higher priority */
+static inline bool tbefore(Event *a, Event *b)
+{
+	if (a->timeout != b->timeout)
+		return a->timeout < b->timeout;
+	return a->priority > b->priority;
+}
+
+static inline void theap_put(int i, Event *ev)
+{
+	theap[i] = ev;
+	ev->heapidx = i;
+}
+
+static void theap_up(int i)
+{
+	Event *ev = theap[i];
+
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (!tbefore(ev, theap[parent]))
+			break;
+		theap_put(i, theap[parent]);
+		i = parent;
+	}
+	theap_put(i, ev);
+}
+
+static void theap_down(int i)
+{
+	Event *ev = theap[i];
+
+	for (;;) {
+		int child = 2 * i + 1;
+		if (child >= theap_cnt)
+			break;
+		if (child + 1 < theap_cnt && tbefore(theap[child + 1], theap[child]))
+			child++;
+		if (!tbefore(theap[child], ev))
+			break;
+		theap_put(i, theap[child]);
+		i = child;
+	}
+	theap_put(i, ev);
+}
+
+static void theap_insert(Event *ev)
+{
+	if (theap_cnt == theap_max) {
+		theap_max = theap_max ? theap_max * 2 : 32;
+		theap = realloc(theap, theap_max * sizeof(Event *));
+		if (!theap)
+			Panic(0, "%s", strnomem);
+	}
+	theap_put(theap_cnt++, ev);
+	theap_up(ev->heapidx);
+}
+
+static void theap_remove(Event *ev)
+{
+	int i = ev->heapidx;
+
+	if (--theap_cnt == i)
+		return;
+	theap_put(i, theap[theap_cnt]);
+	theap_up(i);
+	theap_down(theap[i]->heapidx);
+}
+
+static void unlink_gated(Event *ev)
+{
+	if (!ev->gated)
+		return;
+	if (ev->prev)
+		ev->prev->next = ev->next;
+	else
+		gevs = ev->next;
+	if (ev->next)
+		ev->next->prev = ev->prev;
+	ev->gated = false;
+}
+
+/* move a queued fd event on or off the gated list and re-arm it */
+void evgate(Event *ev)
 {
-	int i = 0;
+	bool active;
 
+	if (!ev->queued || (ev->type != EV_READ && ev->type != EV_WRITE))
+		return;
+	if (ev->condpos && !ev->gated) {
+		ev->prev = NULL;
+		ev->next = gevs;
+		if (gevs)
+			gevs->prev = ev;
+		gevs = ev;
+		ev->gated = true;
+	} else if (!ev->condpos)
+		unlink_gated(ev);
+	active = evactive(ev);
+	if (active != ev->armed) {
+		ev->armed = active;
+		markdirty(ev->fd);
+	}
+}
+
+void evenq(Event *ev)
+{
 	Event *evp, **evpp;
 	if (ev->queued)
 		return;
-	evpp = &evs;
+	ev->queued = true;
+
+	if (ev->type == EV_READ || ev->type == EV_WRITE) {
+		ev->gated = false;
+		ev->armed = false;
+		ev->pending = false;
+		if (ev->fd >= 0) {
+			FdSlot *slot = getslot(ev->fd);
+			ev->fdnext = slot->evs;
+			slot->evs = ev;
+		}
+		evgate(ev);
+		return;
+	}
+
 	if (ev->type == EV_TIMEOUT) {
-		calctimeout = 1;
-		evpp = &tevs;
+		theap_insert(ev);
+		return;
 	}
 
-	for (; (evp = *evpp); evpp = &evp->next)
+	for (evpp = &aevs; (evp = *evpp); evpp = &evp->next)
 		if (ev->priority > evp->priority)
 			break;
 	ev->next = evp;
 	*evpp = ev;
-	ev->queued = true;
-
-	/* check if we need more pollfd */
-	for (evp = evs; evp; evp = evp->next)
-		if (evp->type == EV_READ || evp->type == EV_WRITE)
-			i++;
-
-	if (i > pfd_cnt) {
-		pfd_cnt = i;
-		pfd = realloc(pfd, pfd_cnt * sizeof(struct pollfd));
-	}
 }
 
 void evdeq(Event *ev)
@@ -84,132 +471,103 @@ void evdeq(Event *ev)
 	Event *evp, **evpp;
 	if (!ev || !ev->queued)
 		return;
-	evpp = &evs;
+	ev->queued = false;
+
+	if (ev->type == EV_READ || ev->type == EV_WRITE) {
+		unlink_gated(ev);
+		unlink_fd(ev);
+		return;
+	}
+
 	if (ev->type == EV_TIMEOUT) {
-		calctimeout = 1;
-		evpp = &tevs;
+		theap_remove(ev);
+		return;
 	}
-	for (; (evp = *evpp); evpp = &evp->next)
+
+	for (evpp = &aevs; (evp = *evpp); evpp = &evp->next)
 		if (evp == ev)
 			break;
 	*evpp = ev->next;
-	ev->queued = false;
 	if (ev == nextev)
 		nextev = nextev->next;
-
-	/* mark fd to be skipped (see checks in sched()) */
-	for (int i = 0; i < pfd_cnt; i++)
-		if (pfd[i].fd == ev->fd)
-			pfd[i].fd = -pfd[i].fd;
 }
 
-static Event *calctimo(void)
+/*
+ * Fire every timer that is due, in deadline order. Timers re-armed by a
+ * handler only fire again if they are due and the pass has not yet run
+ * as many handlers as there were timers when it started.
+ */
+static void runtimers(void)
 {
-	Event *ev, *min;
-	long mins;
+	int64_t now = now_ms();
 
-	if ((min = tevs) == NULL)
-		return NULL;
-	mins = min->timeout;
-	for (ev = tevs->next; ev; ev = ev->next) {
-		if (mins > ev->timeout) {
-			min = ev;
-			mins = ev->timeout;
-		}
+	for (int left = theap_cnt; left > 0 && theap_cnt && theap[0]->timeout <= now; left--) {
+		Event *ev = theap[0];
+		evdeq(ev);
+		ev->handler(ev, ev->data);
 	}
-	return min;
 }
 
 void sched(void)
 {
 	Event *ev;
-	Event *timeoutev = NULL;
 	int timeout;
-	int i, n;
+
+#ifdef HAVE_SYS_EPOLL_H
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		usepoll();
+#endif
 
 	for (;;) {
-		if (calctimeout)
-			timeoutev = calctimo();
-		if (timeoutev) {
-			struct timeval now;
-			gettimeofday(&now, NULL);
-			/* tp - timeout */
-			timeout = timeoutev->timeout - (now.tv_sec * 1000 + now.tv_usec / 1000);
-			if (timeout < 0)
-				timeout = 0;
+		timeout = 1000;
+		if (theap_cnt) {
+			int64_t left = theap[0]->timeout - now_ms();
+			timeout = left < 0 ? 0 : left > INT_MAX ? INT_MAX : (int)left;
 		}
 
-		memset(pfd, 0, sizeof(struct pollfd) * pfd_cnt);
-		i = 0;
-		for (ev = evs; ev; ev = ev->next) {
-			if (ev->condpos && *ev->condpos <= (ev->condneg ? *ev->condneg : 0))
-				goto skip;
-			if (ev->type == EV_READ) {
-				pfd[i].fd = ev->fd;
-				pfd[i].events = POLLIN;
-			} else if (ev->type == EV_WRITE) {
-				pfd[i].fd = ev->fd;
-				pfd[i].events = POLLOUT;
+		/* gates may have opened or closed since the last pass */
+		for (ev = gevs; ev; ev = ev->next) {
+			bool active = evactive(ev);
+			if (active != ev->armed) {
+				ev->armed = active;
+				markdirty(ev->fd);
 			}
-skip:
-			if (ev->type == EV_READ || ev->type == EV_WRITE)
-				i++;
 		}
+		syncfds();
 
-		n = poll(pfd, i, timeoutev ? timeout : 1000);
-		if (n < 0) {
-			if (errno != EINTR) {
-				Panic(errno, "poll");
-			}
-			n = 0;
-		} else if (n == 0) {	/* timeout */
-			if (timeoutev) {
-				evdeq(timeoutev);
-				timeoutev->handler(timeoutev, timeoutev->data);
-			}
-		}
+		if (waitfds(timeout) < 0 && errno != EINTR)
+			Panic(errno, "poll");
 
-		i = 0;
+		/* due timers run even when there was I/O, so their latency
+		 * does not grow with the I/O load */
+		runtimers();
+
+		/* handlers may dequeue events still waiting in ready[] */
+		for (int i = 0; i < ready_cnt; i++) {
+			if (!(ev = ready[i]))
+				continue;
+			ev->pending = false;
+			if (!evactive(ev))
+				continue;
+			ev->handler(ev, ev->data);
+		}
+		ready_cnt = 0;
 
-		for (ev = evs; ev; ev = nextev) {
+		for (ev = aevs; ev; ev = nextev) {
 			nextev = ev->next;
-			switch (ev->type) {
-			case EV_READ:
-			case EV_WRITE:
-				/* check if we parsed all events from poll()
-				 * if we did just continue, as we may still
-				 * need to run EV_ALWAYS event */
-				if (n == 0)
-					continue;
-				/* check if we have anything to do for EV_READ
-				 * or EV_WRITE, or if event is still queued,
-				 * if not skip to the next event */
-				if (!pfd[i].revents || pfd[i].fd < 0) {
-					i++;
-					continue;
-				}
-				/* this is one of events from poll(), decrease
-				 * counter */
-				n--;
-				/* advance pollfd pointer */
-				i++;
-				__attribute__ ((fallthrough));
-			default:
-				if (ev->condpos && *ev->condpos <= (ev->condneg ? *ev->condneg : 0))
-					continue;
-				ev->handler(ev, ev->data);
-			}
+			if (!evactive(ev))
+				continue;
+			ev->handler(ev, ev->data);
 		}
 	}
 }
 
 void SetTimeout(Event *ev, int timo)
 {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-
-	ev->timeout = (now.tv_sec * 1000 + now.tv_usec / 1000) + timo;
+	ev->timeout = now_ms() + timo;
 
-	if (ev->queued)
-		calctimeout = 1;
+	if (ev->queued && ev->type == EV_TIMEOUT) {
+		theap_up(ev->heapidx);
+		theap_down(ev->heapidx);
+	}
 }
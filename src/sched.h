@@ -31,7 +31,7 @@
 #define SCREEN_SCHED_H
 
 #include <stdbool.h>
-#include <sys/time.h>
+#include <stdint.h>
 
 typedef enum {
 	EV_TIMEOUT	= 0,
@@ -43,20 +43,28 @@ typedef enum {
 typedef struct Event Event;
 struct Event {
 	Event *next;
+	Event *prev;		/* only maintained for gated fd events */
+	Event *fdnext;		/* other events queued on the same fd */
 	void (*handler) (Event *, void *);
 	void *data;
 	int fd;
 	EventType type;
 	int priority;
-	int timeout;		/* timeout in milliseconds */
+	int64_t timeout;	/* expiry in ms on CLOCK_MONOTONIC */
+	int heapidx;		/* position in the timer heap */
 	bool queued;		/* in evs queue */
+	bool gated;		/* on the list of gated fd events */
+	bool armed;		/* fd interest registered with the backend */
+	bool pending;		/* reported ready, waiting for dispatch */
 	int *condpos;		/* only active if condpos - condneg > 0 */
 	int *condneg;
 };
 
 void evenq (Event *);
 void evdeq (Event *);
+void evgate (Event *);
 void SetTimeout (Event *, int);
+int64_t now_ms (void);
 void sched (void) __attribute__((__noreturn__));
 
 #endif /* SCREEN_SCHED_H */
@@ -113,6 +113,7 @@ char *home;
 
 char *screenlogfile;		/* filename layout */
 int log_flush = 10;		/* flush interval in seconds */
+bool log_timed = false;		/* new logfiles are timed logs */
 bool logtstamp_on = false;	/* tstamp disabled */
 char *logtstamp_string;		/* stamp layout */
 int logtstamp_after = 120;	/* first tstamp after 120s */
@@ -172,6 +173,7 @@ int af;
 #include "process.h"
 #include "socket.h"
 #include "termcap.h"
+#include "timedlog.h"
 #include "tty.h"
 
 char strnomem[] = "Out of memory.";
@@ -255,6 +257,8 @@ static void exit_with_usage(char *myname, char *message, char *arg)
 	printf("-q            Quiet startup. Exits with non-zero return code if unsuccessful.\n");
 	printf("-Q            Commands will send the response to the stdout of the querying process.\n");
 	printf("-r [session]  Reattach to a detached screen process.\n");
+	printf("--replay log [time [window]]\n");
+	printf("              Print what a window showed, from a timed log.\n");
 	printf("-R            Reattach if possible, otherwise start a new session.\n");
 	printf("-s shell      Shell to execute rather than $SHELL.\n");
 	printf("-S sockname   Name this session <pid>.sockname instead of <pid>.<tty>.<host>.\n");
@@ -359,6 +363,8 @@ int main(int argc, char **argv)
 			}
 			if (ap[1] == '-' && !strncmp(ap, "--help", 6))
 				exit_with_usage(myname, NULL, NULL);
+			if (ap[1] == '-' && !strcmp(ap, "--replay"))
+				exit(TLogReplay(argc - 1, argv + 1));
 			while (ap && *ap && *++ap) {
 				switch (*ap) {
 #ifdef ENABLE_TELNET
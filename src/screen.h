@@ -283,6 +283,7 @@ extern int attach_fd;
 extern int dflag;
 extern int force_vt;
 extern int log_flush;
+extern bool log_timed;
 extern int logtstamp_after;
 extern uid_t multi_uid;
 extern int multiattach;
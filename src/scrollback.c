@@ -0,0 +1,626 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#include "config.h"
+
+#include "scrollback.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+#include "ansi.h"
+#include "window.h"
+
+#define SB_CHUNK	64	/* planes per slab chunk */
+
+struct SbPlane {
+	SbPlane	 *next;		/* hash chain, or free list */
+	SbClass	 *class;
+	uint32_t  hash;
+	uint32_t  refs;
+	uint16_t  data[];	/* what the mline points at */
+};
+
+struct SbClass {
+	SbClass	 *next;
+	int	  len;		/* uint16_t per plane */
+	size_t	  used;		/* planes handed out */
+	SbPlane	 *free;
+	void	 *chunks;	/* linked through their first word */
+};
+
+#define PLANE(p) ((SbPlane *)((char *)(p) - offsetof(SbPlane, data)))
+
+static size_t PlaneSize(int len)
+{
+	size_t size = offsetof(SbPlane, data) + len * sizeof(uint16_t);
+	return (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+}
+
+static SbClass *GetClass(Scrollback *sb, int len)
+{
+	SbClass *c;
+
+	for (c = sb->classes; c; c = c->next)
+		if (c->len == len)
+			return c;
+	if ((c = calloc(1, sizeof(SbClass))) == NULL)
+		return NULL;
+	c->len = len;
+	c->next = sb->classes;
+	sb->classes = c;
+	return c;
+}
+
+static void FreeClass(Scrollback *sb, SbClass *c)
+{
+	SbClass **cp;
+	void *chunk;
+
+	for (cp = &sb->classes; *cp != c; cp = &(*cp)->next)
+		;
+	*cp = c->next;
+	while ((chunk = c->chunks) != NULL) {
+		c->chunks = *(void **)chunk;
+		free(chunk);
+	}
+	free(c);
+}
+
+static SbPlane *AllocPlane(Scrollback *sb, int len)
+{
+	SbClass *c;
+	SbPlane *p;
+
+	if ((c = GetClass(sb, len)) == NULL)
+		return NULL;
+	if (c->free == NULL) {
+		size_t size = PlaneSize(len);
+		char *chunk = malloc(sizeof(void *) + SB_CHUNK * size);
+		if (chunk == NULL) {
+			if (c->used == 0)
+				FreeClass(sb, c);
+			return NULL;
+		}
+		*(void **)chunk = c->chunks;
+		c->chunks = chunk;
+		for (int i = SB_CHUNK - 1; i >= 0; i--) {
+			p = (SbPlane *)(chunk + sizeof(void *) + i * size);
+			p->class = c;
+			p->next = c->free;
+			c->free = p;
+		}
+	}
+	p = c->free;
+	c->free = p->next;
+	c->used++;
+	return p;
+}
+
+static bool GrowHash(Scrollback *sb)
+{
+	size_t size = sb->hashsize ? sb->hashsize * 2 : 256;
+	SbPlane **hash, *p, *next;
+
+	if ((hash = calloc(size, sizeof(SbPlane *))) == NULL)
+		return false;
+	for (size_t i = 0; i < sb->hashsize; i++)
+		for (p = sb->hash[i]; p; p = next) {
+			next = p->next;
+			p->next = hash[p->hash & (size - 1)];
+			hash[p->hash & (size - 1)] = p;
+		}
+	free(sb->hash);
+	sb->hash = hash;
+	sb->hashsize = size;
+	return true;
+}
+
+/*
+ * Returns the interned copy of plane, null16 if it is all zero and
+ * NULL if we ran out of memory.
+ */
+static uint16_t *Intern(Scrollback *sb, const uint16_t *plane, int len)
+{
+	uint32_t h = 2166136261u, any = 0;
+	SbPlane *p;
+
+	for (int i = 0; i < len; i++) {
+		h = (h ^ plane[i]) * 16777619u;
+		any |= plane[i];
+	}
+	if (!any)
+		return null16;
+	if (sb->nplanes >= sb->hashsize && !GrowHash(sb) && sb->hashsize == 0)
+		return NULL;
+	for (p = sb->hash[h & (sb->hashsize - 1)]; p; p = p->next)
+		if (p->hash == h && p->class->len == len && !memcmp(p->data, plane, len * sizeof(uint16_t))) {
+			p->refs++;
+			return p->data;
+		}
+	if ((p = AllocPlane(sb, len)) == NULL)
+		return NULL;
+	memcpy(p->data, plane, len * sizeof(uint16_t));
+	p->hash = h;
+	p->refs = 1;
+	p->next = sb->hash[h & (sb->hashsize - 1)];
+	sb->hash[h & (sb->hashsize - 1)] = p;
+	sb->nplanes++;
+	return p->data;
+}
+
+static void Release(Scrollback *sb, uint16_t *plane)
+{
+	SbPlane *p = PLANE(plane), **pp;
+	SbClass *c = p->class;
+
+	if (--p->refs)
+		return;
+	for (pp = &sb->hash[p->hash & (sb->hashsize - 1)]; *pp != p; pp = &(*pp)->next)
+		;
+	*pp = p->next;
+	sb->nplanes--;
+	p->next = c->free;
+	c->free = p;
+	if (--c->used == 0)
+		FreeClass(sb, c);
+}
+
+/*
+ * Turns the attribute planes of a line that goes into the history into
+ * interned ones. The planes the line had are kept for reuse. If there
+ * is no memory for a copy, the attributes are dropped.
+ */
+void sb_freeze(Scrollback *sb, struct mline *ml, int len)
+{
+	uint16_t **planes[] = { &ml->font, &ml->rend };
+
+	for (size_t i = 0; i < sizeof(planes) / sizeof(*planes); i++) {
+		uint16_t *plane = *planes[i];
+		if (plane == null16 || plane == NULL)
+			continue;
+		if ((*planes[i] = Intern(sb, plane, len)) == NULL)
+			*planes[i] = null16;
+		sb_putplane(sb, plane, len);
+	}
+}
+
+/* Gives a history line private copies of its planes again */
+void sb_thaw(Scrollback *sb, struct mline *ml)
+{
+	uint16_t **planes[] = { &ml->font, &ml->rend };
+
+	for (size_t i = 0; i < sizeof(planes) / sizeof(*planes); i++) {
+		uint16_t *plane = *planes[i];
+		if (plane == null16 || plane == NULL)
+			continue;
+		size_t size = PLANE(plane)->class->len * sizeof(uint16_t);
+		if ((*planes[i] = malloc(size)) == NULL)
+			*planes[i] = null16;
+		else
+			memcpy(*planes[i], plane, size);
+		Release(sb, plane);
+	}
+}
+
+/* Lets go of the planes of a history line */
+void sb_release(Scrollback *sb, struct mline *ml)
+{
+	uint16_t **planes[] = { &ml->font, &ml->rend };
+
+	for (size_t i = 0; i < sizeof(planes) / sizeof(*planes); i++) {
+		if (*planes[i] != null16 && *planes[i] != NULL)
+			Release(sb, *planes[i]);
+		*planes[i] = null16;
+	}
+}
+
+/* A zeroed screen plane of len entries */
+uint16_t *sb_getplane(Scrollback *sb, int len)
+{
+	uint16_t *plane;
+
+	if (sb->nspare == 0 || sb->sparelen != len)
+		return calloc(len, sizeof(uint16_t));
+	plane = sb->spare[--sb->nspare];
+	memset(plane, 0, len * sizeof(uint16_t));
+	return plane;
+}
+
+/* Keeps a screen plane that isn't needed any more for sb_getplane() */
+void sb_putplane(Scrollback *sb, uint16_t *plane, int len)
+{
+	if (sb->sparelen != len) {
+		while (sb->nspare)
+			free(sb->spare[--sb->nspare]);
+		sb->sparelen = len;
+	}
+	if (sb->nspare < SB_SPARE)
+		sb->spare[sb->nspare++] = plane;
+	else
+		free(plane);
+}
+
+void sb_free(Scrollback *sb)
+{
+	while (sb->classes)
+		FreeClass(sb, sb->classes);
+	while (sb->nspare)
+		free(sb->spare[--sb->nspare]);
+	free(sb->hash);
+	memset(sb, 0, sizeof(Scrollback));
+}
+
+/*
+ * Packed history pages. The images of a page are turned into a byte
+ * stream (code points below 0x80 take one byte, the rest are written
+ * seven bits at a time) and that is compressed with an LZF style codec:
+ * a control byte below 32 starts a run of that many plus one literal
+ * bytes, anything else is a back reference of (ctrl >> 5) + 2 bytes
+ * (7 means an extra length byte follows) at a distance of up to 8192.
+ */
+
+int compresshist = -1;		/* lines kept unpacked, -1: off */
+
+#define LZ_HLOG		10
+#define LZ_MAXOFF	8192
+#define LZ_MAXLEN	264
+
+static uint8_t *packbuf, *rawbuf;
+static size_t packbufsize, rawbufsize;
+
+static uint8_t *GrowBuf(uint8_t **buf, size_t *size, size_t want)
+{
+	if (want > *size) {
+		free(*buf);
+		if ((*buf = malloc(want)) == NULL)
+			Panic(0, "%s", strnomem);
+		*size = want;
+	}
+	return *buf;
+}
+
+static size_t LzPack(const uint8_t *in, size_t len, uint8_t *out)
+{
+	uint32_t htab[1 << LZ_HLOG];
+	size_t ip = 0, op = 1, lit = 0, litpos = 0;
+
+	memset(htab, 0, sizeof(htab));
+	while (ip < len) {
+		if (ip + 2 < len) {
+			uint32_t h = ((uint32_t)in[ip] << 16 | in[ip + 1] << 8 | in[ip + 2]) * 2654435761u >> (32 - LZ_HLOG);
+			size_t ref = htab[h];
+			htab[h] = ip + 1;
+			if (ref-- && ip - ref <= LZ_MAXOFF && !memcmp(in + ref, in + ip, 3)) {
+				size_t off = ip - ref - 1, n = 3;
+				size_t max = len - ip < LZ_MAXLEN ? len - ip : LZ_MAXLEN;
+				while (n < max && in[ref + n] == in[ip + n])
+					n++;
+				if (lit)
+					out[litpos] = lit - 1;
+				else
+					op--;
+				if (n - 2 < 7)
+					out[op++] = (n - 2) << 5 | off >> 8;
+				else {
+					out[op++] = 7 << 5 | off >> 8;
+					out[op++] = n - 2 - 7;
+				}
+				out[op++] = off & 0xff;
+				ip += n;
+				litpos = op++;
+				lit = 0;
+				continue;
+			}
+		}
+		out[op++] = in[ip++];
+		if (++lit == 32) {
+			out[litpos] = lit - 1;
+			litpos = op++;
+			lit = 0;
+		}
+	}
+	if (lit)
+		out[litpos] = lit - 1;
+	else
+		op--;
+	return op;
+}
+
+static bool LzUnpack(const uint8_t *in, size_t len, uint8_t *out, size_t outlen)
+{
+	size_t ip = 0, op = 0, n, off;
+
+	while (ip < len) {
+		unsigned int ctrl = in[ip++];
+		if (ctrl < 32) {
+			n = ctrl + 1;
+			if (ip + n > len || op + n > outlen)
+				return false;
+			memcpy(out + op, in + ip, n);
+			ip += n;
+			op += n;
+			continue;
+		}
+		n = ctrl >> 5;
+		if (n == 7 && ip < len)
+			n += in[ip++];
+		n += 2;
+		if (ip >= len)
+			return false;
+		off = ((ctrl & 0x1f) << 8 | in[ip++]) + 1;
+		if (off > op || op + n > outlen)
+			return false;
+		for (; n; n--, op++)
+			out[op] = out[op - off];
+	}
+	return op == outlen;
+}
+
+static int PageLines(Window *win, int pg)
+{
+	int n = win->w_histheight - pg * SB_PAGE;
+	return n < SB_PAGE ? n : SB_PAGE;
+}
+
+/*
+ * A page can be packed once all of its lines are old enough. Slots
+ * that haven't been filled yet count as old, they are blank.
+ */
+static bool PageCold(Window *win, int pg)
+{
+	int n = PageLines(win, pg);
+
+	for (int i = pg * SB_PAGE; i < pg * SB_PAGE + n; i++) {
+		int age = (win->w_histidx - 1 - i + 2 * win->w_histheight) % win->w_histheight;
+		if (age < compresshist || win->w_hlines[i].image == NULL)
+			return false;
+	}
+	return true;
+}
+
+static void PackPage(Window *win, int pg)
+{
+	SbPages *pp = &win->w_pages;
+	SbPage *page;
+	int n = PageLines(win, pg), w = win->w_width + 1;
+	size_t rawlen = 0, len;
+	uint8_t *raw, *packed;
+
+	if (pp->npages == 0) {
+		pp->npages = (win->w_histheight + SB_PAGE - 1) / SB_PAGE;
+		if ((pp->page = calloc(pp->npages, sizeof(SbPage))) == NULL) {
+			pp->npages = 0;
+			return;
+		}
+	}
+	raw = GrowBuf(&rawbuf, &rawbufsize, (size_t)n * w * 5);
+	for (int i = pg * SB_PAGE; i < pg * SB_PAGE + n; i++) {
+		uint32_t *image = win->w_hlines[i].image;
+		for (int x = 0; x < w; x++) {
+			uint32_t c = image[x];
+			for (; c >= 0x80; c >>= 7)
+				raw[rawlen++] = (c & 0x7f) | 0x80;
+			raw[rawlen++] = c;
+		}
+	}
+	packed = GrowBuf(&packbuf, &packbufsize, rawlen + rawlen / 32 + 2);
+	len = LzPack(raw, rawlen, packed);
+
+	page = &pp->page[pg];
+	if ((page->data = malloc(len)) == NULL)
+		return;
+	memcpy(page->data, packed, len);
+	page->len = len;
+	page->rawlen = rawlen;
+	page->fresh = 0;
+	for (int i = pg * SB_PAGE; i < pg * SB_PAGE + n; i++) {
+		free(win->w_hlines[i].image);
+		win->w_hlines[i].image = NULL;
+	}
+}
+
+static void UnpackPage(Window *win, int pg)
+{
+	SbPage *page = &win->w_pages.page[pg];
+	int n = PageLines(win, pg), w = win->w_width + 1;
+	uint8_t *raw = GrowBuf(&rawbuf, &rawbufsize, page->rawlen);
+	size_t r = 0;
+
+	if (!LzUnpack(page->data, page->len, raw, page->rawlen))
+		Panic(0, "corrupt history page");
+	for (int i = pg * SB_PAGE; i < pg * SB_PAGE + n; i++) {
+		uint32_t *image;
+		if (i < pg * SB_PAGE + page->fresh) {
+			/* has new contents already, skip it */
+			for (int x = 0; x < w; x++)
+				while (raw[r++] & 0x80)
+					;
+			continue;
+		}
+		if ((image = malloc(w * sizeof(uint32_t))) == NULL)
+			Panic(0, "%s", strnomem);
+		for (int x = 0; x < w; x++) {
+			uint32_t c = 0;
+			int shift = 0;
+			while (raw[r] & 0x80) {
+				c |= (uint32_t)(raw[r++] & 0x7f) << shift;
+				shift += 7;
+			}
+			image[x] = c | (uint32_t)raw[r++] << shift;
+		}
+		win->w_hlines[i].image = image;
+	}
+}
+
+/* Whether the packed lines of a packed page have their images */
+static bool PageUnpacked(Window *win, int pg)
+{
+	return win->w_hlines[pg * SB_PAGE + win->w_pages.page[pg].fresh].image != NULL;
+}
+
+/* Frees the images of the packed lines of a page, the packed copy stays */
+static void FreeImages(Window *win, int pg)
+{
+	int n = PageLines(win, pg);
+
+	for (int i = pg * SB_PAGE + win->w_pages.page[pg].fresh; i < pg * SB_PAGE + n; i++) {
+		free(win->w_hlines[i].image);
+		win->w_hlines[i].image = NULL;
+	}
+}
+
+static void LruRemove(SbPages *pp, int pg)
+{
+	for (int i = 0; i < pp->nlru; i++)
+		if (pp->lru[i] == pg) {
+			memmove(pp->lru + i, pp->lru + i + 1, (pp->nlru - i - 1) * sizeof(int));
+			pp->nlru--;
+			return;
+		}
+}
+
+/* Makes page pg the most recently used one, unpacking it if needed */
+static void LruTouch(Window *win, int pg)
+{
+	SbPages *pp = &win->w_pages;
+
+	if (pp->nlru && pp->lru[0] == pg)
+		return;
+	if (PageUnpacked(win, pg))
+		LruRemove(pp, pg);
+	else {
+		if (pp->nlru == SB_LRU)
+			FreeImages(win, pp->lru[--pp->nlru]);
+		UnpackPage(win, pg);
+	}
+	memmove(pp->lru + 1, pp->lru, pp->nlru * sizeof(int));
+	pp->lru[0] = pg;
+	pp->nlru++;
+}
+
+/* Turns a packed page into plain lines again */
+static void DropPage(Window *win, int pg)
+{
+	SbPage *page = &win->w_pages.page[pg];
+
+	if (!PageUnpacked(win, pg))
+		UnpackPage(win, pg);
+	else
+		LruRemove(&win->w_pages, pg);
+	free(page->data);
+	page->data = NULL;
+}
+
+/* Line i of w_hlines, with its image unpacked */
+struct mline *sb_histline(Window *win, int i)
+{
+	SbPages *pp = &win->w_pages;
+
+	if (pp->npages && pp->page[i / SB_PAGE].data && i % SB_PAGE >= pp->page[i / SB_PAGE].fresh)
+		LruTouch(win, i / SB_PAGE);
+	return &win->w_hlines[i];
+}
+
+/*
+ * Line i of w_hlines is about to be overwritten. The history is a ring,
+ * so this normally happens to the lines of a page in order; the rest of
+ * the page stays packed until it is read or overwritten as well.
+ */
+void sb_reuse(Window *win, int i)
+{
+	SbPages *pp = &win->w_pages;
+	SbPage *page;
+	struct mline *ml = &win->w_hlines[i];
+	int pg = i / SB_PAGE;
+
+	if (pp->npages == 0 || (page = &pp->page[pg])->data == NULL)
+		return;
+	if (i % SB_PAGE != page->fresh) {
+		DropPage(win, pg);
+		return;
+	}
+	page->fresh++;
+	if (ml->image == NULL && (ml->image = malloc((win->w_width + 1) * sizeof(uint32_t))) == NULL)
+		Panic(0, "%s", strnomem);
+	if (page->fresh == PageLines(win, pg)) {
+		LruRemove(pp, pg);
+		free(page->data);
+		page->data = NULL;
+	}
+}
+
+/* Packs the page of the line that just got old enough, if it can be */
+void sb_pack(Window *win)
+{
+	SbPages *pp = &win->w_pages;
+	int i, pg;
+
+	if (compresshist < 0 || compresshist >= win->w_scrollback_height)
+		return;
+	i = (win->w_histidx - 1 - compresshist + 2 * win->w_histheight) % win->w_histheight;
+	pg = i / SB_PAGE;
+	if ((pp->npages == 0 || pp->page[pg].data == NULL) && PageCold(win, pg))
+		PackPage(win, pg);
+}
+
+void sb_packall(Window *win)
+{
+	SbPages *pp = &win->w_pages;
+
+	if (compresshist < 0)
+		return;
+	for (int pg = 0; pg * SB_PAGE < win->w_histheight; pg++)
+		if ((pp->npages == 0 || pp->page[pg].data == NULL) && PageCold(win, pg))
+			PackPage(win, pg);
+}
+
+void sb_unpackall(Window *win)
+{
+	SbPages *pp = &win->w_pages;
+
+	for (int pg = 0; pg < pp->npages; pg++)
+		if (pp->page[pg].data)
+			DropPage(win, pg);
+	sb_freepages(pp);
+}
+
+/* Frees the packed copies only, unpacked lines have to be freed separately */
+void sb_freepages(SbPages *pp)
+{
+	for (int pg = 0; pg < pp->npages; pg++)
+		free(pp->page[pg].data);
+	free(pp->page);
+	memset(pp, 0, sizeof(SbPages));
+}
+
+/* Size of the packed pages, and what they would take unpacked */
+void sb_packstats(Window *win, size_t *packed, size_t *raw)
+{
+	SbPages *pp = &win->w_pages;
+
+	*packed = *raw = 0;
+	for (int pg = 0; pg < pp->npages; pg++)
+		if (pp->page[pg].data) {
+			*packed += pp->page[pg].len;
+			*raw += (size_t)PageLines(win, pg) * (win->w_width + 1) * sizeof(uint32_t);
+		}
+}
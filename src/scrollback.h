@@ -0,0 +1,97 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#ifndef SCREEN_SCROLLBACK_H
+#define SCREEN_SCROLLBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+#define SB_SPARE	64	/* screen planes kept around for reuse */
+#define SB_PAGE		32	/* history lines per packed page */
+#define SB_LRU		16	/* packed pages kept unpacked after a read */
+
+typedef struct SbPlane SbPlane;
+typedef struct SbClass SbClass;
+typedef struct Window Window;
+
+/*
+ * Storage for the attribute planes (font and rend) of a window's
+ * history. Lines that scroll into the history have their
+ * planes interned: a plane that is all zero becomes the shared null
+ * plane, and identical planes are stored once and reference counted.
+ * The interned copies are carved out of per-size slabs. History planes
+ * are read only; use sb_thaw() before changing one.
+ *
+ * The screen planes that are given up this way are kept for reuse, so
+ * that scrolling doesn't malloc and free planes all the time.
+ */
+typedef struct Scrollback {
+	SbPlane	 **hash;		/* interned planes, by content */
+	size_t	   hashsize;		/* power of two */
+	size_t	   nplanes;		/* number of interned planes */
+	SbClass	  *classes;		/* slabs, one per plane length */
+	uint16_t  *spare[SB_SPARE];	/* free screen planes */
+	int	   nspare;
+	int	   sparelen;		/* their length */
+	bool	   thawed;		/* history planes are private (resize) */
+} Scrollback;
+
+/*
+ * With compresshist set, the images of history lines further than that
+ * from the screen are packed SB_PAGE lines at a time and their image
+ * pointers are NULL. Go through sb_histline() (the WIN() macro does)
+ * to read them; it unpacks the page and keeps it around for a while.
+ */
+typedef struct SbPage {
+	uint8_t	 *data;		/* NULL if the page isn't packed */
+	uint32_t  len;
+	uint32_t  rawlen;	/* before compression */
+	int	  fresh;	/* leading lines already overwritten */
+} SbPage;
+
+typedef struct SbPages {
+	SbPage	 *page;
+	int	  npages;
+	int	  lru[SB_LRU];	/* unpacked pages, most recent first */
+	int	  nlru;
+} SbPages;
+
+extern int compresshist;
+
+void	  sb_freeze(Scrollback *, struct mline *, int);
+void	  sb_thaw(Scrollback *, struct mline *);
+void	  sb_release(Scrollback *, struct mline *);
+uint16_t *sb_getplane(Scrollback *, int);
+void	  sb_putplane(Scrollback *, uint16_t *, int);
+void	  sb_free(Scrollback *);
+
+struct mline *sb_histline(Window *, int);
+void	  sb_reuse(Window *, int);
+void	  sb_pack(Window *);
+void	  sb_packall(Window *);
+void	  sb_unpackall(Window *);
+void	  sb_freepages(SbPages *);
+void	  sb_packstats(Window *, size_t *, size_t *);
+
+#endif /* SCREEN_SCROLLBACK_H */
@@ -1127,6 +1127,7 @@ static void AskPassword(Message *m)
 
 	free(realname);
 	AddStr(prompt);
+	ForgetShadow();
 }
 
 #if ENABLE_PAM
@@ -51,7 +51,9 @@ static int e_tgetflag(char *);
 static int e_tgetnum(char *);
 static int findseq_ge(char *, int, unsigned char **);
 static void setseqoff(unsigned char *, int, int);
+static int SGRParam(char *);
 static int addmapseq(char *, int, int);
+static uint32_t TermcapSum(void);
 static int remmapseq(char *, int);
 
 char Termcap[TERMCAP_BUFSIZE + 8];	/* new termcap +8:"TERMCAP=" */
@@ -67,6 +69,18 @@ UP=\\E[%dA:bs:bt=\\E[Z:cd=\\E[J:ce=\\E[K:cl=\\E[H\\E[J:cm=\\E[%i%d;%dH:\
 ct=\\E[3g:do=^J:nd=\\E[C:pt:rc=\\E8:rs=\\Ec:sc=\\E7:st=\\EH:up=\\EM:\
 le=^H:bl=^G:cr=^M:it#8:ho=\\E[H:nw=\\EE:ta=^I:is=\\E)0:";
 
+/* Returns n if s is exactly ESC [ n m, -1 otherwise */
+static int SGRParam(char *s)
+{
+	int n = 0;
+
+	if (s == NULL || s[0] != '\033' || s[1] != '[' || s[2] == 'm')
+		return -1;
+	for (s += 2; *s >= '0' && *s <= '9' && n < 256; s++)
+		n = n * 10 + *s - '0';
+	return (s[0] == 'm' && s[1] == 0 && n < 256) ? n : -1;
+}
+
 char *gettermcapstring(char *s)
 {
 	int i;
@@ -273,6 +287,23 @@ int InitTermcap(int width, int height)
 	}
 	if (D_CAF || D_CAB || D_CSF || D_CSB)
 		D_hascolor = 1;
+
+	/* Can attribute and color changes be sent as one SGR sequence? */
+	D_sgr = D_ME && (strstr(D_ME, "\033[m") || strstr(D_ME, "\033[0m"));
+	for (i = 0; i < NATTR; i++) {
+		D_sgrattr[i] = 0;
+		if (D_attrtab[i] == NULL)
+			continue;
+		if ((t = SGRParam(D_attrtab[i])) <= 0)
+			D_sgr = 0;
+		else
+			D_sgrattr[i] = t;
+	}
+	if (D_hascolor && (!D_CAF || !D_CAB))
+		D_sgr = 0;
+	for (i = 0; D_sgr && D_hascolor && i < 8; i++)
+		if (SGRParam(tgoto(D_CAF, 0, i)) != 30 + i || SGRParam(tgoto(D_CAB, 0, i)) != 40 + i)
+			D_sgr = 0;
 	if (D_UT)
 		D_BE = 1;	/* screen erased with background color */
 
@@ -365,6 +396,8 @@ int InitTermcap(int width, int height)
 	D_CRcost = CalcCost(D_CR);
 	D_IMcost = CalcCost(D_IM);
 	D_EIcost = CalcCost(D_EI);
+	free(D_mvcost);		/* capabilities changed, forget the move costs */
+	D_mvcost = NULL;
 
 	if (D_CAN) {
 		D_auto_nuke = true;
@@ -394,6 +427,7 @@ int InitTermcap(int width, int height)
 	D_seqh = NULL;
 
 	D_tcinited = 1;
+	D_tcsum = TermcapSum();
 	MakeTermcap(0);
 	/* Make sure libterm uses external term properties for our tputs() calls.  */
 	e_tgetent(tbuf, D_termname);
@@ -401,6 +435,32 @@ int InitTermcap(int width, int height)
 	return 0;
 }
 
+/*
+ * Checksum of everything the output routines take from the terminal
+ * description: displays with the same sum turn the same update into the
+ * same bytes, see FanoutReplay().
+ */
+static uint32_t TermcapSum(void)
+{
+	uint32_t h = 2166136261u;
+	char *s;
+
+	for (s = D_termname; *s; s++)
+		h = (h ^ (unsigned char)*s) * 16777619;
+	for (int i = 0; i < T_N; i++) {
+		if (term[i].type != T_STR) {
+			h = (h ^ (uint32_t)D_tcs[i].num) * 16777619;
+			continue;
+		}
+		h = (h ^ (D_tcs[i].str != NULL)) * 16777619;
+		for (s = D_tcs[i].str; s && *s; s++)
+			h = (h ^ (unsigned char)*s) * 16777619;
+	}
+	for (int i = 0; i < 256; i++)
+		h = (h ^ (unsigned char)D_c0_tab[i]) * 16777619;
+	return h;
+}
+
 int remap(int n, int map)
 {
 	char *s = NULL;
@@ -0,0 +1,44 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#include "../width.h"
+#include "signature.h"
+#include "macros.h"
+
+SIGNATURE_CHECK(ucs_class, int, (uint32_t));
+SIGNATURE_CHECK(ucs_class_bisearch, int, (uint32_t));
+
+int main(void)
+{
+	/* the generated tables must agree with the interval lists everywhere,
+	 * including past the end of Unicode */
+	for (uint32_t c = 0; c < 0x120000; c++)
+		ASSERT(ucs_class(c) == ucs_class_bisearch(c));
+
+	/* a few known values */
+	ASSERT(ucs_class('a') == 0);
+	ASSERT(ucs_class(0x0591) == UCS_COMBINING);
+	ASSERT(ucs_class(0x4e00) == UCS_WIDE);
+	ASSERT(ucs_class(0x00a1) == UCS_AMBIGUOUS);
+	ASSERT(ucs_class(0x0300) == (UCS_AMBIGUOUS | UCS_COMBINING));
+	ASSERT(ucs_class(0x7fffffff) == 0);
+
+	return 0;
+}
@@ -0,0 +1,500 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#include "config.h"
+
+#include "timedlog.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "screen.h"
+#include "ansi.h"
+#include "encoding.h"
+#include "fileio.h"
+#include "logfile.h"
+#include "resize.h"
+
+static char *keybuf;		/* TLOG_KEY payload being put together */
+static size_t keylen, keysize;
+
+static void put_be(char *p, uint64_t v, int n)
+{
+	while (n-- > 0) {
+		p[n] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+static uint64_t get_be(unsigned char *p, int n)
+{
+	uint64_t v = 0;
+
+	while (n-- > 0)
+		v = v << 8 | *p++;
+	return v;
+}
+
+/*
+ * Wall clock time at the start plus the monotonic clock since, so that
+ * the records of a session never go back in time.
+ */
+static int64_t TLogTime(void)
+{
+	static int64_t base;
+	struct timespec ts;
+	int64_t now;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	if (!base) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		base = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000 - now;
+	}
+	return base + now;
+}
+
+static int TLogRecord(Window *win, int type, int64_t t, char *buf, size_t len)
+{
+	char h[TLOG_HDRSIZE];
+
+	h[0] = type;
+	h[1] = 0;
+	put_be(h + 2, win->w_number, 2);
+	put_be(h + 4, len, 4);
+	put_be(h + 8, t, 8);
+	if (logfwrite(win->w_log, h, TLOG_HDRSIZE) < 1)
+		return -1;
+	return len ? logfwrite(win->w_log, buf, len) : 1;
+}
+
+static int TLogWindow(Window *win, int64_t t)
+{
+	char buf[6];
+
+	win->w_tlogwidth = win->w_width;
+	win->w_tlogheight = win->w_height;
+	win->w_tlogencoding = win->w_encoding;
+	put_be(buf, win->w_width, 2);
+	put_be(buf + 2, win->w_height, 2);
+	put_be(buf + 4, win->w_encoding, 2);
+	return TLogRecord(win, TLOG_WINDOW, t, buf, sizeof(buf));
+}
+
+static void KeyAdd(char *s, size_t n)
+{
+	if (keylen + n > keysize) {
+		size_t size = keysize ? keysize : 4096;
+		char *nbuf;
+
+		while (size < keylen + n)
+			size *= 2;
+		if ((nbuf = realloc(keybuf, size)) == NULL)
+			return;
+		keybuf = nbuf;
+		keysize = size;
+	}
+	memcpy(keybuf + keylen, s, n);
+	keylen += n;
+}
+
+static char *KeyColor(char *p, uint32_t c, int base)
+{
+	switch (c & 0x07000000) {
+	case 0x01000000:
+		if ((c & 0xff) < 8)
+			return p + sprintf(p, ";%d", base + (c & 0xff));
+		return p + sprintf(p, ";%d", base + 60 + (c & 0xff) - 8);
+	case 0x02000000:
+		return p + sprintf(p, ";%d;5;%d", base + 8, c & 0xff);
+	case 0x04000000:
+		return p + sprintf(p, ";%d;2;%d;%d;%d", base + 8, c >> 16 & 0xff, c >> 8 & 0xff, c & 0xff);
+	}
+	return p;
+}
+
+static void KeyRend(uint32_t attr, uint32_t colorbg, uint32_t colorfg)
+{
+	char buf[64], *p = buf;
+
+	p += sprintf(p, "\033[0");
+	if (attr & A_BD)
+		p += sprintf(p, ";1");
+	if (attr & A_DI)
+		p += sprintf(p, ";2");
+	if (attr & A_IT)
+		p += sprintf(p, ";3");
+	if (attr & A_US)
+		p += sprintf(p, ";4");
+	if (attr & A_BL)
+		p += sprintf(p, ";5");
+	if (attr & (A_RV | A_SO))
+		p += sprintf(p, ";7");
+	p = KeyColor(p, colorfg, 30);
+	p = KeyColor(p, colorbg, 40);
+	*p++ = 'm';
+	KeyAdd(buf, p - buf);
+}
+
+/*
+ * Puts together output that paints the window as it is now on a
+ * cleared screen: the lines with their renditions, the scrolling
+ * region, the cursor and the current rendition.
+ */
+static void KeyPaint(Window *win)
+{
+	static char clear[] = "\033[r\033[?6l\033[4l\033[0m\033(B\033[H\033[2J";
+	char buf[32];
+	int font = 0;
+	int n;
+
+	keylen = 0;
+	KeyAdd(clear, sizeof(clear) - 1);
+	for (int y = 0; y < win->w_height; y++) {
+		struct mline *ml = &win->w_mlines[y];
+		uint16_t rend = 0;
+		int xe;
+
+		for (xe = win->w_width - 1; xe >= 0 && ml->image[xe] == ' ' && ml->rend[xe] == 0; xe--)
+			;
+		if (xe < 0)
+			continue;
+		n = sprintf(buf, "\033[%d;1H", y + 1);
+		KeyAdd(buf, n);
+		for (int x = 0; x <= xe; x++) {
+			if (ml->rend[x] != rend) {
+				struct mrend *r = &mrendtab[rend = ml->rend[x]];
+				KeyRend(r->attr, r->colorbg, r->colorfg);
+			}
+			if (win->w_encoding == UTF8) {
+				if (ml->font[x] == 0xff)
+					continue;	/* right half of a wide char */
+				/* characters of other charsets are sent as Unicode */
+				n = EncodeChar(buf, ml->font[x] ? ml->image[x] | ml->font[x] << 16 : ml->image[x], UTF8, NULL);
+			} else
+				n = EncodeChar(buf, ml->image[x] | ml->font[x] << 16, win->w_encoding, &font);
+			if (n > 0)
+				KeyAdd(buf, n);
+		}
+		if ((n = EncodeChar(buf, -1, win->w_encoding, &font)) > 0)
+			KeyAdd(buf, n);
+		if (rend)
+			KeyAdd("\033[0m", 4);
+	}
+	if (win->w_top != 0 || win->w_bot != win->w_height - 1) {
+		n = sprintf(buf, "\033[%d;%dr", win->w_top + 1, win->w_bot + 1);
+		KeyAdd(buf, n);
+	}
+	if (win->w_origin)
+		KeyAdd("\033[?6h", 5);
+	n = sprintf(buf, "\033[%d;%dH", win->w_y + 1 - (win->w_origin ? win->w_top : 0),
+		    (win->w_x < win->w_width ? win->w_x : win->w_width - 1) + 1);
+	KeyAdd(buf, n);
+	if (win->w_insert)
+		KeyAdd("\033[4h", 4);
+	if (!win->w_wrap)
+		KeyAdd("\033[?7l", 5);
+	KeyRend(win->w_rend.attr, win->w_rend.colorbg, win->w_rend.colorfg);
+}
+
+static int TLogKey(Window *win)
+{
+	char idx[TLOG_IDXSIZE];
+	int64_t t = TLogTime();
+
+	put_be(idx, t, 8);
+	put_be(idx + 8, logftell(win->w_log), 8);
+	put_be(idx + 16, win->w_number, 4);
+	put_be(idx + 20, win->w_width, 2);
+	put_be(idx + 22, win->w_height, 2);
+	logfindex(win->w_log, idx, sizeof(idx));
+	win->w_tlogkey = 0;
+	if (TLogWindow(win, t) < 1)
+		return -1;
+	KeyPaint(win);
+	return TLogRecord(win, TLOG_KEY, t, keybuf, keylen);
+}
+
+/*
+ * Tells whether logfile name, which is about to be appended to, already
+ * holds output of the other format than timed asks for. An empty file
+ * goes with either.
+ */
+bool TLogMismatch(char *name, bool timed)
+{
+	char magic[TLOG_MAGICLEN];
+	ssize_t n;
+	int fd;
+
+	if ((fd = secopen(name, O_RDONLY, 0)) < 0)
+		return false;	/* can't tell */
+	n = read(fd, magic, TLOG_MAGICLEN);
+	close(fd);
+	if (n <= 0)
+		return false;
+	return timed != (n == TLOG_MAGICLEN && !memcmp(magic, TLOG_MAGIC, TLOG_MAGICLEN));
+}
+
+/*
+ * Writes a record of output to a timed log, like logfwrite() does for a
+ * plain one. Called before the output reaches the window, so that a
+ * key record shows what it is written over.
+ */
+int TLogWrite(Window *win, char *buf, size_t len)
+{
+	Log *l = win->w_log;
+
+	if (win->w_tloggen != l->gen) {
+		/* a new file, or one the window didn't write to yet */
+		if (logftell(l) == 0) {
+			logfindex(l, NULL, 0);
+			if (logfwrite(l, TLOG_MAGIC, TLOG_MAGICLEN) < 1)
+				return -1;
+		}
+		win->w_tloggen = l->gen;
+		win->w_tlogkey = TLOG_KEYBYTES;
+	}
+	if (win->w_tlogkey >= TLOG_KEYBYTES) {
+		if (TLogKey(win) < 1)
+			return -1;
+	} else if (win->w_width != win->w_tlogwidth || win->w_height != win->w_tlogheight
+		   || win->w_encoding != win->w_tlogencoding) {
+		if (TLogWindow(win, TLogTime()) < 1)
+			return -1;
+	}
+	win->w_tlogkey += len;
+	return TLogRecord(win, TLOG_DATA, TLogTime(), buf, len);
+}
+
+/*
+ * Takes "+secs" after the start of the log, "hh:mm[:ss]" on the day it
+ * started (or the first day after it) or "yyyy-mm-dd hh:mm[:ss]".
+ */
+static int TLogParseTime(char *s, int64_t start, int64_t *t)
+{
+	time_t tt = start / 1000000;
+	struct tm tm = *localtime(&tt);
+	int n, year, mon, day, hour, min, sec = 0;
+	char c;
+
+	if (*s == '+') {
+		char *e;
+		double d = strtod(s + 1, &e);
+
+		if (*e || e == s + 1 || d < 0)
+			return -1;
+		*t = start + (int64_t)(d * 1000000);
+		return 0;
+	}
+	if ((n = sscanf(s, "%d-%d-%d %d:%d:%d%c", &year, &mon, &day, &hour, &min, &sec, &c)) == 5 || n == 6) {
+		tm.tm_year = year - 1900;
+		tm.tm_mon = mon - 1;
+		tm.tm_mday = day;
+	} else if ((n = sscanf(s, "%d:%d:%d%c", &hour, &min, &sec, &c)) != 2 && n != 3)
+		return -1;
+	tm.tm_hour = hour;
+	tm.tm_min = min;
+	tm.tm_sec = sec;
+	tm.tm_isdst = -1;
+	if ((tt = mktime(&tm)) == -1)
+		return -1;
+	if (n <= 3 && tt + (n == 2 ? 60 : 1) <= start / 1000000) {
+		tm.tm_mday++;
+		tm.tm_isdst = -1;
+		tt = mktime(&tm);
+	}
+	*t = (int64_t)tt * 1000000 + 999999;
+	return 0;
+}
+
+/* the offset of the last key record of window wn at or before t */
+static off_t TLogSeek(char *name, int64_t t, int wn)
+{
+	unsigned char e[TLOG_IDXSIZE];
+	char idxname[MAXPATHLEN];
+	struct stat st;
+	off_t lo = 0, hi, off = TLOG_MAGICLEN;
+	FILE *f;
+
+	if (snprintf(idxname, sizeof(idxname), "%s.idx", name) >= (int)sizeof(idxname))
+		return off;
+	if ((f = fopen(idxname, "r")) == NULL)
+		return off;
+	if (fstat(fileno(f), &st) == 0) {
+		/* find the first entry after t */
+		hi = st.st_size / TLOG_IDXSIZE;
+		while (lo < hi) {
+			off_t mid = lo + (hi - lo) / 2;
+
+			if (fseeko(f, mid * TLOG_IDXSIZE, SEEK_SET) || fread(e, TLOG_IDXSIZE, 1, f) != 1)
+				break;
+			if ((int64_t)get_be(e, 8) <= t)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		/* and walk back to one of the window */
+		while (lo-- > 0) {
+			if (fseeko(f, lo * TLOG_IDXSIZE, SEEK_SET) || fread(e, TLOG_IDXSIZE, 1, f) != 1)
+				break;
+			if ((int)get_be(e + 16, 4) == wn) {
+				off = get_be(e + 8, 8);
+				break;
+			}
+		}
+	}
+	fclose(f);
+	return off;
+}
+
+static Window *TLogReplayWindow(int width, int height, int encoding)
+{
+	Window *win;
+
+	if ((win = calloc(1, sizeof(Window))) == NULL)
+		return NULL;
+	win->w_type = W_TYPE_PLAIN;
+	win->w_ptyfd = -1;
+	win->w_layer.l_bottom = &win->w_layer;
+	win->w_layer.l_layfn = &WinLf;
+	win->w_layer.l_data = (char *)win;
+	win->w_savelayer = &win->w_layer;
+	win->w_title = win->w_akachange = win->w_akabuf;
+	if (ChangeWindowSize(win, width, height, DEFAULTHISTHEIGHT)) {
+		free(win);
+		return NULL;
+	}
+	win->w_encoding = encoding;
+	ResetWindow(win);
+	mru_window = win;	/* keeps its renditions in use */
+	return win;
+}
+
+static void TLogPrint(Window *win)
+{
+	char buf[16];
+	int n;
+
+	for (int y = 0; y < win->w_height; y++) {
+		struct mline *ml = &win->w_mlines[y];
+		int xe;
+
+		for (xe = win->w_width - 1; xe >= 0 && ml->image[xe] == ' '; xe--)
+			;
+		for (int x = 0; x <= xe; x++) {
+			if (ml->image[x] == 0xff && ml->font[x] == 0xff)
+				continue;
+			if ((n = EncodeChar(buf, ml->image[x], win->w_encoding, NULL)) > 0)
+				fwrite(buf, n, 1, stdout);
+		}
+		putchar('\n');
+	}
+}
+
+/*
+ * screen --replay file [time [window]]
+ * Feeds the output of a window in a timed log through the emulator, from
+ * the last key record before the time on, and prints the screen the
+ * window had then. Without time, the end of the log is shown. The
+ * window defaults to the first one in the file.
+ */
+int TLogReplay(int argc, char **argv)
+{
+	unsigned char h[TLOG_HDRSIZE];
+	char magic[TLOG_MAGICLEN];
+	char *buf = NULL;
+	size_t size = 0;
+	int64_t t = INT64_MAX;
+	Window *win = NULL;
+	FILE *f;
+	int wn;
+
+	if (setgid(real_gid) || setuid(real_uid)) {
+		perror("setuid");
+		return 1;
+	}
+	if (argc < 1 || argc > 3) {
+		fprintf(stderr, "Usage: screen --replay logfile [+secs|hh:mm[:ss]|yyyy-mm-dd hh:mm[:ss] [window]]\n");
+		return 1;
+	}
+	if ((f = fopen(argv[0], "r")) == NULL) {
+		perror(argv[0]);
+		return 1;
+	}
+	if (fread(magic, TLOG_MAGICLEN, 1, f) != 1 || memcmp(magic, TLOG_MAGIC, TLOG_MAGICLEN)
+	    || fread(h, TLOG_HDRSIZE, 1, f) != 1) {
+		fprintf(stderr, "%s: not a timed log\n", argv[0]);
+		fclose(f);
+		return 1;
+	}
+	wn = argc > 2 ? atoi(argv[2]) : (int)get_be(h + 2, 2);
+	if (argc > 1 && TLogParseTime(argv[1], get_be(h + 8, 8), &t)) {
+		fprintf(stderr, "%s: bad time\n", argv[1]);
+		fclose(f);
+		return 1;
+	}
+
+	fseeko(f, TLogSeek(argv[0], t, wn), SEEK_SET);
+	while (fread(h, TLOG_HDRSIZE, 1, f) == 1) {
+		size_t len = get_be(h + 4, 4);
+
+		if ((int64_t)get_be(h + 8, 8) > t)
+			break;
+		if (len > size) {
+			char *nbuf;
+
+			if ((nbuf = realloc(buf, len)) == NULL)
+				break;
+			buf = nbuf;
+			size = len;
+		}
+		if (len && fread(buf, len, 1, f) != 1)
+			break;
+		if ((int)get_be(h + 2, 2) != wn)
+			continue;
+		if (h[0] == TLOG_WINDOW && len >= 6) {
+			int width = get_be((unsigned char *)buf, 2);
+			int height = get_be((unsigned char *)buf + 2, 2);
+			int encoding = get_be((unsigned char *)buf + 4, 2);
+
+			if (!win)
+				win = TLogReplayWindow(width, height, encoding);
+			else {
+				ChangeWindowSize(win, width, height, win->w_histheight);
+				win->w_encoding = encoding;
+			}
+		} else if ((h[0] == TLOG_KEY || h[0] == TLOG_DATA) && win && len)
+			WriteString(win, buf, len);
+	}
+	fclose(f);
+	free(buf);
+	if (!win) {
+		fprintf(stderr, "%s: no output of window %d by then\n", argv[0], wn);
+		return 1;
+	}
+	TLogPrint(win);
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * This file is part of GNU screen.
+ *
+ * GNU screen is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (see the file COPYING); if not, see
+ * <http://www.gnu.org/licenses>.
+ *
+ ****************************************************************
+ */
+
+#ifndef SCREEN_TIMEDLOG_H
+#define SCREEN_TIMEDLOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "window.h"
+
+/*
+ * A timed log ("logfile format timed") starts with TLOG_MAGIC, followed
+ * by records of a TLOG_HDRSIZE byte header and its payload. Numbers are
+ * big endian. The header is
+ *
+ *	byte 0		record type
+ *	byte 1		0
+ *	bytes 2-3	window number
+ *	bytes 4-7	payload length
+ *	bytes 8-15	microseconds since the epoch, never going back
+ *
+ * A TLOG_WINDOW record (width, height and encoding, two bytes each)
+ * comes before the first output of a window in a file and whenever one
+ * of them changes. Every TLOG_KEYBYTES of output of a window a
+ * TLOG_WINDOW record and a TLOG_KEY record, which paints the whole
+ * window from scratch, are written and listed in the index file,
+ * name.idx. Its entries are TLOG_IDXSIZE bytes: time (8 bytes), offset
+ * of the TLOG_WINDOW record (8), window number (4), width (2) and
+ * height (2), in the order they were written.
+ */
+
+#define TLOG_MAGIC	"SCRTLOG1"
+#define TLOG_MAGICLEN	8
+#define TLOG_HDRSIZE	16
+#define TLOG_IDXSIZE	24
+#define TLOG_KEYBYTES	(256 * 1024)
+
+#define TLOG_DATA	'D'	/* window output */
+#define TLOG_WINDOW	'W'	/* window size and encoding */
+#define TLOG_KEY	'K'	/* window contents */
+
+bool TLogMismatch (char *, bool);
+int  TLogWrite (Window *, char *, size_t);
+int  TLogReplay (int, char **);
+
+#endif /* SCREEN_TIMEDLOG_H */
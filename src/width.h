@@ -0,0 +1,15 @@
+#ifndef SCREEN_WIDTH_H
+#define SCREEN_WIDTH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* character classes, ORed together */
+#define UCS_WIDE	0x01	/* double width */
+#define UCS_AMBIGUOUS	0x02	/* double width with cjkwidth */
+#define UCS_COMBINING	0x04	/* zero width, combines with the character before */
+
+int   ucs_class (uint32_t);
+int   ucs_class_bisearch (uint32_t);
+
+#endif /* SCREEN_WIDTH_H */
@@ -0,0 +1,98 @@
+#! /bin/sh
+
+if test -z "$AWK"; then
+  AWK=awk
+fi
+if test -z "$srcdir"; then
+  srcdir=.
+fi
+
+LC_ALL=C
+export LC_ALL
+
+rm -f widthtab.h
+cat << EOF > widthtab.h
+/*
+ * This file is automagically created from width.c -- DO NOT EDIT
+ */
+
+EOF
+
+$AWK < ${srcdir}/width.c >> widthtab.h '
+function hex(s,   i, n) {
+  s = toupper(substr(s, 3))
+  n = 0
+  for (i = 1; i <= length(s); i++)
+    n = n * 16 + index("0123456789ABCDEF", substr(s, i, 1)) - 1
+  return n
+}
+
+/^static const struct interval .*\[\] = {/ {
+  bit = 0
+  if ($5 == "wide[]") bit = 1
+  if ($5 == "ambiguous[]") bit = 2
+  if ($5 == "combining[]") bit = 4
+  next
+}
+/^};/ { bit = 0; next }
+
+bit != 0 {
+  line = $0
+  while (match(line, /\{0x[0-9A-Fa-f]+, *0x[0-9A-Fa-f]+\}/)) {
+    split(substr(line, RSTART + 1, RLENGTH - 2), r, ", *")
+    last = hex(r[2])
+    for (c = hex(r[1]); c <= last; c++) {
+      if (int(cls[c] / bit) % 2 == 0)
+        cls[c] += bit
+      used[int(c / 256)] = 1
+    }
+    line = substr(line, RSTART + RLENGTH)
+  }
+}
+
+END {
+  # blocks of 256 characters, identical blocks are stored once
+  nblocks = 1
+  key[""] = 0
+  for (b = 0; b < 4352; b++) {
+    k = ""
+    if (b in used)
+      for (c = b * 256; c < b * 256 + 256; c++)
+        k = k ((c in cls) ? cls[c] : 0)
+    if (k ~ /^0*$/)
+      k = ""
+    if (!(k in key)) {
+      key[k] = nblocks
+      blocks[nblocks++] = k
+    }
+    idx[b] = key[k]
+  }
+
+  print "#define WIDTH_SHIFT\t8"
+  print "#define WIDTH_MASK\t0xff"
+  print "#define WIDTH_LIMIT\t0x110000"
+  print ""
+  print "static const " (nblocks > 256 ? "uint16_t" : "uint8_t") " width_index[WIDTH_LIMIT >> WIDTH_SHIFT] = {"
+  for (b = 0; b < 4352; b += 16) {
+    s = "\t"
+    for (i = b; i < b + 16; i++)
+      s = s idx[i] ","
+    print s
+  }
+  print "};"
+  print ""
+  print "static const uint8_t width_blocks[" nblocks "][WIDTH_MASK + 1] = {"
+  for (n = 0; n < nblocks; n++) {
+    k = blocks[n]
+    print "\t{"
+    for (i = 0; i < 256; i += 32) {
+      s = "\t\t"
+      for (j = i; j < i + 32; j++)
+        s = s (k == "" ? "0" : substr(k, j + 1, 1)) ","
+      print s
+    }
+    print "\t},"
+  }
+  print "};"
+}
+'
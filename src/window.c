@@ -42,6 +42,7 @@
 #include <sys/ioctl.h>
 #include <sys/wait.h>
 
+#include "encoding.h"
 #include "fileio.h"
 #include "help.h"
 #include "input.h"
@@ -52,6 +53,7 @@
 #include "resize.h"
 #include "telnet.h"
 #include "termcap.h"
+#include "timedlog.h"
 #include "tty.h"
 #include "utmp.h"
 #include "winmsg.h"
@@ -67,11 +69,13 @@ static void win_readev_fn(Event *, void *);
 static void win_writeev_fn(Event *, void *);
 static void win_resurrect_zombie_fn(Event *, void *);
 static int muchpending(Window *, Event *);
+static void BlockFullDisplays(Window *);
 static void paste_slowev_fn(Event *, void *);
 static void pseu_readev_fn(Event *, void *);
 static void pseu_writeev_fn(Event *, void *);
 static void win_silenceev_fn(Event *, void *);
 static void win_destroyev_fn(Event *, void *);
+static void win_frameev_fn(Event *, void *);
 
 static int ForkWindow(Window *, char **, char *);
 static void zmodem_found(Window *, int, char *, size_t);
@@ -79,6 +83,9 @@ static void zmodemFin(char *, size_t, void *);
 static int zmodem_parse(Window *, char *, size_t);
 
 bool VerboseCreate = false;		/* XXX move this to user.h */
+int displayfps = 0;			/* frames per second, 0: update at once */
+bool passthrough = false;		/* send pty output to the terminal as it is */
+bool deflognonblock = false;		/* w_lognonblock of new windows */
 
 char DefaultShell[] = "/bin/sh";
 #ifndef HAVE_EXECVPE
@@ -365,7 +372,8 @@ static void WinRestore(void)
  * DoStartLog constructs a path for the "want to be logfile" in buf and
  * attempts logfopen.
  *
- * returns 0 on success.
+ * returns 0 on success, -3 (reported already) if the file holds the
+ * other log format.
  */
 int DoStartLog(Window *window, char *buf, int bufsize)
 {
@@ -381,6 +389,15 @@ int DoStartLog(Window *window, char *buf, int bufsize)
 
 	if ((window->w_log = logfopen(buf, islogfile(buf) ? NULL : secfopen(buf, "a"))) == NULL)
 		return -2;
+	if (window->w_log->opencount == 1 ? TLogMismatch(buf, log_timed) : window->w_log->timed != log_timed) {
+		/* raw output and timed records don't mix */
+		Msg(0, "Logfile \"%s\" is %s timed log, not appending to it", buf, log_timed ? "not a" : "a");
+		logfclose(window->w_log);
+		window->w_log = NULL;
+		return -3;
+	}
+	window->w_log->timed = log_timed;
+	window->w_tloggen = 0;
 	if (!logflushev.queued) {
 		n = log_flush ? log_flush : (logtstamp_after + 4) / 5;
 		if (n) {
@@ -510,7 +527,8 @@ int MakeWindow(struct NewWindow *newwin)
 	if (type == W_TYPE_GROUP)
 		f = -1;
 
-	if ((p = calloc(1, sizeof(Window))) == NULL) {
+	if ((p = calloc(1, sizeof(Window))) == NULL || (p->w_readbuf = malloc(IOSIZE)) == NULL) {
+		free(p);
 		if (type == W_TYPE_PTY)
 			ClosePTY(f);
 		else
@@ -545,7 +563,9 @@ int MakeWindow(struct NewWindow *newwin)
 	 * This is intended to be useful for detached startup.
 	 * But is still better than default bits with a NULL user.
 	 */
+	p->w_readsize = IOSIZE;
 	if (NewWindowAcl(p, display ? D_user : users)) {
+		free(p->w_readbuf);
 		free((char *)p);
 		if (type == W_TYPE_PTY)
 			ClosePTY(f);
@@ -600,6 +620,7 @@ int MakeWindow(struct NewWindow *newwin)
 			ACLBYTE(p->w_lio_notify, i) |= ACLBIT(i);
 	}
 	p->w_slowpaste = nwin.slow;
+	p->w_lognonblock = deflognonblock;
 
 	p->w_norefresh = 0;
 	strncpy(p->w_tty, TtyName, MAXSTR - 1);
@@ -715,6 +736,9 @@ int MakeWindow(struct NewWindow *newwin)
 	p->w_destroyev.type = EV_TIMEOUT;
 	p->w_destroyev.data = NULL;
 	p->w_destroyev.handler = win_destroyev_fn;
+	p->w_frameev.type = EV_TIMEOUT;
+	p->w_frameev.data = (char *)p;
+	p->w_frameev.handler = win_frameev_fn;
 
 	SetForeWindow(p);
 	Activate(p->w_norefresh);
@@ -896,7 +920,10 @@ void FreeWindow(Window *window)
 	evdeq(&window->w_silenceev);
 	evdeq(&window->w_zombieev);
 	evdeq(&window->w_destroyev);
+	evdeq(&window->w_frameev);
 	FreePaster(&window->w_paster);
+	free(window->w_readbuf);
+	sb_free(&window->w_sb);
 	free((char *)window);
 }
 
@@ -1378,8 +1405,10 @@ void FreePseudowin(Window *w)
 	}
 	evdeq(&pwin->p_readev);
 	evdeq(&pwin->p_writeev);
-	if (w->w_readev.condneg == (int *)&pwin->p_inlen)
+	if (w->w_readev.condneg == (int *)&pwin->p_inlen) {
 		w->w_readev.condpos = w->w_readev.condneg = NULL;
+		evgate(&w->w_readev);
+	}
 	evenq(&w->w_readev);
 	free((char *)pwin);
 	w->w_pwin = NULL;
@@ -1444,21 +1473,23 @@ static int muchpending(Window *p, Event *event)
 {
 	for (Canvas *cv = p->w_layer.l_cvlist; cv; cv = cv->c_lnext) {
 		display = cv->c_display;
+		if (D_blocked)
+			continue;	/* it gets redisplayed once it drains */
 		if (D_status == STATUS_ON_WIN && !D_status_bell) {
 			/* wait 'til status is gone */
 			event->condpos = &const_one;
 			event->condneg = (int *)&D_status;
+			evgate(event);
 			return 1;
 		}
-		if (D_blocked)
-			continue;
-		if (D_obufp - D_obuf > D_obufmax + D_blocked_fuzz) {
+		if (ObufUsed() > D_obufmax + D_blocked_fuzz) {
 			if (D_nonblock == 0) {
 				D_blocked = 1;
 				continue;
 			}
 			event->condpos = &D_obuffree;
 			event->condneg = &D_obuflenmax;
+			evgate(event);
 			if (D_nonblock > 0 && !D_blockedev.queued) {
 				SetTimeout(&D_blockedev, D_nonblock);
 				evenq(&D_blockedev);
@@ -1469,15 +1500,286 @@ static int muchpending(Window *p, Event *event)
 	return 0;
 }
 
+/*
+ * With nonblock 0 a display whose output piled up is blocked as soon as
+ * possible, so that it skips the rest of the output instead of getting
+ * it late: it is brought up to date once it drains. A drained pty read
+ * can be far larger than the display's buffer, so the check is also
+ * done in between. Canvases of a split display are paused while the
+ * read is processed and only get the final state, so they don't need it.
+ */
+#define BLOCK_CHECK_SIZE	1024	/* bytes of window output in between */
+
+static bool BlockCheckNeeded(Window *p)
+{
+	for (Canvas *cv = p->w_layer.l_cvlist; cv; cv = cv->c_lnext) {
+		display = cv->c_display;
+		if (!D_blocked && D_nonblock == 0 && cv->c_slorient == SLICE_UNKN)
+			return true;
+	}
+	return false;
+}
+
+static void BlockFullDisplays(Window *p)
+{
+	for (Canvas *cv = p->w_layer.l_cvlist; cv; cv = cv->c_lnext) {
+		display = cv->c_display;
+		if (!D_blocked && D_nonblock == 0 && ObufUsed() > D_obufmax + D_blocked_fuzz)
+			D_blocked = 1;
+	}
+}
+
+/*
+ * Double the read size while the drained pty output keeps filling the
+ * buffer and halve it again once it drops to a quarter of it, so fast
+ * producers need fewer wakeups and idle windows don't pin large buffers.
+ */
+static void AdaptReadSize(Window *p, size_t len)
+{
+	size_t size = p->w_readsize;
+	char *buf;
+
+	if (len == p->w_readsize && size < IOSIZE_MAX)
+		size *= 2;
+	else if (len <= p->w_readsize / 4 && size > IOSIZE)
+		size /= 2;
+	else
+		return;
+	if ((buf = realloc(p->w_readbuf, size)) == NULL)
+		return;		/* keep going with the old size */
+	p->w_readbuf = buf;
+	p->w_readsize = size;
+}
+
+#ifdef TIOCPKT
+static void PtyPacket(Window *p, char c)
+{
+	if (c & TIOCPKT_NOSTOP)
+		WNewAutoFlow(p, 0);
+	if (c & TIOCPKT_DOSTOP)
+		WNewAutoFlow(p, 1);
+}
+#endif
+
+/*
+ * A pty read returns at most a page, so keep reading until the pty is
+ * empty or the buffer is full. In packet mode each read starts with a
+ * status byte, which is read over the last data byte and put back.
+ * Errors are left to the next wakeup.
+ */
+static int DrainPty(Window *p, int fd, char *bp, int len, int room)
+{
+	int n;
+
+#ifndef TIOCPKT
+	(void)p; /* unused */
+#endif
+	while (len < room) {
+#ifdef TIOCPKT
+		char *q = bp + len - 1;
+		char c = *q;
+
+		n = read(fd, q, room - len + 1);
+		if (n > 0 && *q)
+			PtyPacket(p, *q);
+		*q = c;
+		if (n <= 0)
+			break;
+		len += n - 1;
+#else
+		if ((n = read(fd, bp + len, room - len)) <= 0)
+			break;
+		len += n;
+#endif
+	}
+	return len;
+}
+
+/*
+ * Passthrough. While a window fills a display on its own and the
+ * terminal is left in the same state as the emulator, the pty output
+ * can go to the terminal unchanged. Only text and a few CSI sequences
+ * that any ANSI terminal and our emulator handle alike qualify; all
+ * else goes the normal way. A sequence split across reads is held back
+ * in w_ptcarry until it is complete.
+ */
+static bool PassthroughUsable(Window *p, Canvas *cv)
+{
+	display = cv->c_display;
+	if (cv->c_lnext || cv->c_layer != &p->w_layer || D_cvlist != cv || cv->c_next)
+		return false;
+	if (cv->c_xs || cv->c_ys || cv->c_xe != D_width - 1 || cv->c_ye != D_height - 1 || cv->c_xoff || cv->c_yoff)
+		return false;
+	if (p->w_width != D_width || p->w_height != D_height || p->w_pwin)
+		return false;
+	if (D_status || D_blocked || !D_tcinited || displayfps > 0)
+		return false;
+	if (p->w_encoding != D_encoding || (D_encoding != UTF8 && D_encoding != 0))
+		return false;
+	if (!D_AM || !D_XN || !D_CM || !D_CS || !D_BE || D_lp_missing || D_mbcs || D_realfont != ASCII)
+		return false;
+	if (!p->w_wrap || p->w_insert || p->w_origin || p->w_autolf || p->w_mbcs || p->w_ss || p->w_FontL != ASCII)
+		return false;
+	if (p->w_x >= p->w_width)
+		return false;	/* the terminal's pending wrap can't be restored */
+	if (p->w_ptcarrylen == 0 && (p->w_state != LIT || (p->w_encoding == UTF8 && p->w_decodestate)))
+		return false;
+	return true;
+}
+
+/*
+ * Whether the display renders the SGR parameters args exactly as the
+ * emulator does: attributes only if the termcap sends that very SGR for
+ * them, colors only as far as the display has them.
+ */
+static bool PassthroughSGR(int *args, int nargs)
+{
+	static const signed char sgrattr[] = { -1, ATTR_BD, ATTR_DI, ATTR_IT, ATTR_US, ATTR_BL, -1, ATTR_RV };
+
+	if (!D_sgr)
+		return false;
+	for (int i = 0; i < nargs; i++) {
+		int j = args[i];
+
+		if ((j == 38 || j == 48) && i + 2 < nargs && args[i + 1] == 5) {
+			if (D_CCO != 256 || args[i + 2] > 255)
+				return false;
+			i += 2;
+		} else if ((j == 38 || j == 48) && i + 4 < nargs && args[i + 1] == 2) {
+			if (!hastruecolor || args[i + 2] > 255 || args[i + 3] > 255 || args[i + 4] > 255)
+				return false;
+			i += 4;
+		} else if ((j >= 30 && j <= 37) || j == 39 || (j >= 40 && j <= 47) || j == 49) {
+			if (!D_hascolor)
+				return false;
+		} else if ((j >= 90 && j <= 97) || (j >= 100 && j <= 107)) {
+			if (!D_hascolor || !D_CXT)
+				return false;
+		} else if (j == 22) {
+			if (D_sgrattr[ATTR_BD] != 1 || D_sgrattr[ATTR_DI] != 2)
+				return false;
+		} else if (j > 22 && j <= 27)
+			j -= 20;
+		else if (j != 0 && j >= (int)ARRAY_SIZE(sgrattr))
+			return false;
+		if (j > 0 && j < (int)ARRAY_SIZE(sgrattr) && (sgrattr[j] < 0 || D_sgrattr[sgrattr[j]] != j))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Returns the length of the unfinished sequence at the end of w_ptcarry
+ * followed by buf, or -1 if anything in there must be left to the
+ * emulator. *sgr is set if a complete SGR sequence is in there.
+ */
+static int PassthroughScan(Window *p, char *buf, int len, bool *sgr)
+{
+	enum { PT_TEXT, PT_ESC, PT_CSI, PT_UTF8 } state = PT_TEXT;
+	int need = 0, seqlen = 0;
+	int args[ARRAY_SIZE(p->w_ptcarry)], nargs = 0;
+	uint32_t c, cp = 0, min = 0;
+
+	for (int i = -p->w_ptcarrylen; i < len; i++) {
+		c = (unsigned char)(i < 0 ? p->w_ptcarry[p->w_ptcarrylen + i] : buf[i]);
+		seqlen++;
+		switch (state) {
+		case PT_TEXT:
+			if ((c >= ' ' && c < 0x7f) || c == '\r' || c == '\n')
+				break;
+			if (c == '\033') {
+				state = PT_ESC;
+				continue;
+			}
+			if (p->w_encoding != UTF8 || c < 0xc2 || c > 0xf4)
+				return -1;
+			need = c < 0xe0 ? 1 : c < 0xf0 ? 2 : 3;
+			cp = c & (0x3f >> need);
+			min = need == 1 ? 0xa0 : need == 2 ? 0x800 : 0x10000;
+			state = PT_UTF8;
+			continue;
+		case PT_ESC:
+			if (c != '[')
+				return -1;
+			state = PT_CSI;
+			args[0] = 0;
+			nargs = 1;
+			continue;
+		case PT_CSI:
+			if ((c >= '0' && c <= '9') || c == ';') {
+				if (seqlen >= (int)sizeof(p->w_ptcarry))
+					return -1;
+				if (c == ';')
+					args[nargs++] = 0;
+				else if ((args[nargs - 1] = args[nargs - 1] * 10 + c - '0') > 0xffff)
+					return -1;
+				continue;
+			}
+			if (!c || !strchr("ABCDGHJKdfm", c))
+				return -1;
+			if (c == 'm') {
+				if (!PassthroughSGR(args, nargs))
+					return -1;
+				*sgr = true;
+			}
+			break;
+		case PT_UTF8:
+			if ((c & 0xc0) != 0x80)
+				return -1;
+			cp = cp << 6 | (c & 0x3f);
+			if (--need)
+				continue;
+			/* C1 controls, overlong forms and what may not take one cell */
+			if (cp < min || cp > 0x10ffff || (cp >= 0xd800 && cp < 0xe000) || utf8_isdouble(cp) || utf8_iscomb(cp))
+				return -1;
+			break;
+		}
+		state = PT_TEXT;
+		seqlen = 0;
+	}
+	return seqlen;
+}
+
+static bool PassthroughOutput(Window *p, char *buf, int len)
+{
+	Canvas *cv = p->w_layer.l_cvlist;
+	int pend, fwd, n;
+	bool sgr = false;
+
+	if (!passthrough || !cv || !PassthroughUsable(p, cv) || (pend = PassthroughScan(p, buf, len, &sgr)) < 0) {
+		p->w_ptcarrylen = 0;
+		return false;
+	}
+	PassthroughBegin(p);
+	fwd = p->w_ptcarrylen + len - pend;
+	n = fwd < p->w_ptcarrylen ? fwd : p->w_ptcarrylen;
+	AddRaw(p->w_ptcarry, n);
+	if (fwd > n)
+		AddRaw(buf, fwd - n);
+	if (pend > len) {
+		memmove(p->w_ptcarry, p->w_ptcarry + p->w_ptcarrylen - (pend - len), pend - len);
+		memmove(p->w_ptcarry + pend - len, buf, len);
+	} else
+		memmove(p->w_ptcarry, buf + len - pend, pend);
+	p->w_ptcarrylen = pend;
+
+	/* keep the window image, the terminal has the output already */
+	p->w_layer.l_cvlist = NULL;
+	WriteString(p, buf, len);
+	p->w_layer.l_cvlist = cv;
+	display = cv->c_display;
+	PassthroughEnd(p, sgr);
+	return true;
+}
+
 static void win_readev_fn(Event *event, void *data)
 {
 	Window *p = (Window *)data;
-	char buf[IOSIZE], *bp;
+	char *buf, *bp;
 	int size, len;
 	int wtop;
 
-	bp = buf;
-	size = IOSIZE;
+	size = p->w_readsize;
 
 	wtop = p->w_pwin && W_WTOP(p);
 	if (wtop) {
@@ -1485,6 +1787,7 @@ static void win_readev_fn(Event *event, void *data)
 		if (size <= 0) {
 			event->condpos = &const_IOSIZE;
 			event->condneg = (int *)&p->w_pwin->p_inlen;
+			evgate(event);
 			return;
 		}
 	}
@@ -1494,18 +1797,22 @@ static void win_readev_fn(Event *event, void *data)
 		if (p->w_blocked) {
 			event->condpos = &const_one;
 			event->condneg = &p->w_blocked;
+			evgate(event);
 			return;
 		}
-	if (event->condpos)
+	if (event->condpos) {
 		event->condpos = event->condneg = NULL;
+		evgate(event);
+	}
 
 	if ((len = p->w_outlen)) {
 		p->w_outlen = 0;
+		p->w_ptcarrylen = 0;
 		WriteString(p, p->w_outbuf, len);
 		return;
 	}
 
-	if ((len = read(event->fd, buf, size)) <= 0) {
+	if ((len = read(event->fd, p->w_readbuf, size)) <= 0) {
 		if (errno == EINTR || errno == EAGAIN)
 			return;
 #if defined(EWOULDBLOCK) && (EWOULDBLOCK != EAGAIN)
@@ -1515,21 +1822,23 @@ static void win_readev_fn(Event *event, void *data)
 		WindowDied(p, 0, 0);
 		return;
 	}
+	bp = buf = p->w_readbuf;
 #ifdef TIOCPKT
 	if (p->w_type == W_TYPE_PTY) {
-		if (buf[0]) {
-			if (buf[0] & TIOCPKT_NOSTOP)
-				WNewAutoFlow(p, 0);
-			if (buf[0] & TIOCPKT_DOSTOP)
-				WNewAutoFlow(p, 1);
-		}
+		if (buf[0])
+			PtyPacket(p, buf[0]);
 		bp++;
 		len--;
 	}
 #endif
+	if (p->w_type == W_TYPE_PTY)
+		len = DrainPty(p, event->fd, bp, len, size - (bp - buf));
+	AdaptReadSize(p, bp - buf + len);
+	bp = p->w_readbuf + (bp - buf);	/* the buffer may have moved */
+	buf = p->w_readbuf;
 #ifdef ENABLE_TELNET
 	if (p->w_type == W_TYPE_TELNET)
-		len = TelIn(p, bp, len, buf + ARRAY_SIZE(buf) - (bp + len));
+		len = TelIn(p, bp, len, buf + p->w_readsize - (bp + len));
 #endif
 	if (len == 0)
 		return;
@@ -1540,7 +1849,26 @@ static void win_readev_fn(Event *event, void *data)
 		p->w_pwin->p_inlen += len;
 	}
 
+	if (PassthroughOutput(p, bp, len))
+		return;
+	if (displayfps > 0) {
+		/* collect the changes, win_frameev_fn shows them */
+		LayPauseFrame(&p->w_layer, 1);
+		WriteString(p, bp, len);
+		LayPauseFrame(&p->w_layer, 0);
+		if (!p->w_frameev.queued) {
+			SetTimeout(&p->w_frameev, 1000 / displayfps);
+			evenq(&p->w_frameev);
+		}
+		return;
+	}
 	LayPause(&p->w_layer, 1);
+	while (len > BLOCK_CHECK_SIZE && BlockCheckNeeded(p)) {
+		WriteString(p, bp, BLOCK_CHECK_SIZE);
+		BlockFullDisplays(p);
+		bp += BLOCK_CHECK_SIZE;
+		len -= BLOCK_CHECK_SIZE;
+	}
 	WriteString(p, bp, len);
 	LayPause(&p->w_layer, 0);
 
@@ -1601,6 +1929,7 @@ static void pseu_readev_fn(Event *event, void *data)
 		if (size <= 0) {
 			event->condpos = &const_IOSIZE;
 			event->condneg = (int *)&p->w_inlen;
+			evgate(event);
 			return;
 		}
 	}
@@ -1609,10 +1938,13 @@ static void pseu_readev_fn(Event *event, void *data)
 	if (p->w_blocked) {
 		event->condpos = &const_one;
 		event->condneg = &p->w_blocked;
+		evgate(event);
 		return;
 	}
-	if (event->condpos)
+	if (event->condpos) {
 		event->condpos = event->condneg = NULL;
+		evgate(event);
+	}
 
 	if ((len = p->w_outlen)) {
 		p->w_outlen = 0;
@@ -1674,6 +2006,15 @@ static void win_silenceev_fn(Event *event, void *data)
 	}
 }
 
+static void win_frameev_fn(Event *event, void *data)
+{
+	Window *p = (Window *)data;
+
+	(void)event; /* unused */
+
+	LayFlushFrame(&p->w_layer);
+}
+
 static void win_destroyev_fn(Event *event, void *data)
 {
 	Window *p = (Window *)event->data;
@@ -1718,9 +2059,11 @@ static int zmodem_parse(Window *p, char *bp, size_t len)
 					zmodem_abort(p, NULL);
 					D_blocked = 0;
 					D_readev.condpos = D_readev.condneg = NULL;
+					evgate(&D_readev);
 					while (len-- > 0)
 						AddChar(*bp++);
 					Flush(0);
+					ForgetShadow();
 					Activate(D_fore ? D_fore->w_norefresh : 0);
 					return 1;
 				}
@@ -1793,6 +2136,7 @@ static void zmodem_found(Window *p, int send, char *bp, size_t len)
 		evdeq(&D_blockedev);
 		D_readev.condpos = &const_IOSIZE;
 		D_readev.condneg = (int *)&p->w_inlen;
+		evgate(&D_readev);
 		ClearAll();
 		GotoPos(0, 0);
 		SetRendition(&mchar_blank);
@@ -1800,6 +2144,7 @@ static void zmodem_found(Window *p, int send, char *bp, size_t len)
 		AddStr(send ? "**\030B01" : "**\030B00");
 		while (len-- > 0)
 			AddChar(*bp++);
+		ForgetShadow();
 		display = olddisplay;
 		return;
 	}
@@ -1829,6 +2174,7 @@ void zmodem_abort(Window *p, Display *d)
 		display = d;
 		D_blocked = 0;
 		D_readev.condpos = D_readev.condneg = NULL;
+		evgate(&D_readev);
 		Activate(D_fore ? D_fore->w_norefresh : 0);
 	}
 	display = olddisplay;
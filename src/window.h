@@ -40,6 +40,7 @@
 #include "screen.h"
 #include "layer.h"
 #include "display.h"
+#include "scrollback.h"
 
 struct NewWindow {
 	int	StartAt;	/* where to start the search for the slot */
@@ -153,6 +154,7 @@ struct Window {
 	Event w_readev;
 	Event w_writeev;
 	Event w_silenceev;		/* silence event */
+	Event w_frameev;		/* displayfps frame event */
 	Event w_zombieev;		/* event to try to resurrect window */
 	int	 w_poll_zombie_timeout;
 	int	 w_ptyfd;		/* fd of the master pty */
@@ -160,6 +162,10 @@ struct Window {
 	size_t	 w_inlen;
 	char	 w_outbuf[IOSIZE];
 	size_t	 w_outlen;
+	char	*w_readbuf;		/* pty read buffer */
+	size_t	 w_readsize;		/* its current, adaptive size */
+	char	 w_ptcarry[16];		/* passthrough: unfinished sequence */
+	int	 w_ptcarrylen;
 	bool	 w_aflag;		/* (-a option) */
 	bool	 w_dynamicaka;		/* should we change name */
 	char	*w_title;		/* name of the window */
@@ -217,7 +223,14 @@ struct Window {
 	int	 w_bell;		/* bell status of this window */
 	int	 w_flow;		/* flow flags */
 	Log	 *w_log;	/* log to file */
+	bool	 w_lognonblock;		/* drop log output rather than wait */
+	bool	 w_logdropping;		/* and did so on the last write */
 	int	 w_logsilence;		/* silence in secs */
+	unsigned w_tloggen;		/* timed log file we wrote a key to */
+	int	 w_tlogwidth;		/* and the size and encoding in it */
+	int	 w_tlogheight;
+	int	 w_tlogencoding;
+	size_t	 w_tlogkey;		/* output since the last key record */
 	int	 w_monitor;		/* monitor status */
 	int	 w_silencewait;		/* wait for silencewait secs */
 	int	 w_silence;		/* silence status (Lloyd Zusman) */
@@ -233,6 +246,8 @@ struct Window {
 	int	 w_histidx;		/* 0 <= histidx < histheight; where we insert lines */
 	int	 w_scrollback_height;	/* number of lines of output stored, to be updated with w_histidx, w_histheight */
 	struct	 mline *w_hlines;	/* history buffer */
+	Scrollback w_sb;		/* attribute planes of the history */
+	SbPages	 w_pages;		/* packed history images */
 	struct	 paster w_paster;	/* paste info */
 	pid_t	 w_pid;			/* process at the other end of ptyfd */
 	pid_t	 w_deadpid;		/* saved w_pid of a process that closed the ptyfd to us */
@@ -270,6 +285,7 @@ struct Window {
 		int    histheight;
 		struct mline *hlines;
 		int    histidx;
+		SbPages pages;
 		struct cursor cursor;
 	} w_alt;
 
@@ -316,7 +332,7 @@ struct Window {
  */
 
 #define WIN(y) ((y < fore->w_histheight) ? \
-      &fore->w_hlines[(fore->w_histidx + y) % fore->w_histheight] \
+      sb_histline(fore, (fore->w_histidx + y) % fore->w_histheight) \
     : &fore->w_mlines[y - fore->w_histheight])
 
 #define Layer2Window(l) ((Window *)(l)->l_bottom->l_data)
@@ -347,6 +363,9 @@ void execvpe(char *, char **, char **);
 extern char DefaultShell[];
 
 extern bool VerboseCreate;
+extern int displayfps;
+extern bool passthrough;
+extern bool deflognonblock;
 
 extern const struct LayFuncs WinLf;
 extern struct NewWindow nwin_undef, nwin_default, nwin_options;
@@ -41,6 +41,7 @@
 #include "help.h"
 #include "logfile.h"
 #include "mark.h"
+#include "misc.h"
 #include "process.h"
 #include "sched.h"
 
@@ -56,6 +57,36 @@ WinMsgBuf *g_winmsg;
 /* escape char for backtick output */
 #define WINMSG_BT_ESC '\005'
 
+/* number of compiled messages kept around */
+#define WINMSG_CACHE 16
+
+/*
+ * A message string compiled into a list of literal text runs and escapes,
+ * so that it need not be parsed again on every refresh. DEPS has a bit set
+ * for every escape character used.
+ */
+typedef struct {
+	char       type;   /* escape character, or 0 for literal text */
+	WinMsgEsc  esc;
+	char      *s;      /* escape character within the source copy, or text */
+	size_t     len;    /* length of literal text */
+	uint64_t   rend;   /* parsed rendition of WINESC_REND_START */
+} WinMsgOp;
+
+typedef struct WinMsgProg WinMsgProg;
+struct WinMsgProg {
+	WinMsgProg *next;
+	char       *src;   /* copy of the message string */
+	int         chesc;
+	char       *text;  /* literal text, with ^ escapes resolved */
+	WinMsgOp   *ops;
+	int         nops;
+	uint64_t    deps[2];
+	int         busy;  /* being expanded; do not free */
+};
+
+static WinMsgProg *winmsg_progs;
+
 /* redundant definition abstraction for escape character handlers; note that
  * a variable varadic macro name is a gcc extension and is not portable, so
  * we instead use two separate macros */
@@ -68,7 +99,7 @@ WinMsgBuf *g_winmsg;
 #define winmsg_esc__def(name) static void winmsg_esc__name(name)
 #define winmsg_esc(name) winmsg_esc__def(name)(WINMSG_ESC_PARAMS)
 #define winmsg_esc_ex(name, ...) winmsg_esc__def(name)(WINMSG_ESC_PARAMS, __VA_ARGS__)
-#define WINMSG_ESC_ARGS &esc, &s, wmbc, cond
+#define WINMSG_ESC_ARGS &esc, &s, wmbc, &cond
 #define WinMsgDoEsc(name) winmsg_esc__name(name)(WINMSG_ESC_ARGS)
 #define WinMsgDoEscEx(name, ...) winmsg_esc__name(name)(WINMSG_ESC_ARGS, __VA_ARGS__)
 
@@ -319,32 +350,11 @@ winmsg_esc_ex(PadOrTrunc, int *numpad, int *lastpad, int padlen)
 /**
  * Processes rendition
  *
- * The first character of SRC is assumed to be (unverified) the opening brace
- * of the sequence.
+ * The rendition R has already been parsed by WinMsgCompile().
  */
-winmsg_esc(Rend)
+winmsg_esc_ex(Rend, uint64_t r)
 {
-	char rbuf[RENDBUF_SIZE];
-	uint8_t i;
-	uint64_t r;
-
-	(*src)++;
-	for (i = 0; i < (RENDBUF_SIZE-1); i++) {
-		char c = (*src)[i];
-		if (c && c != WINESC_REND_END)
-			rbuf[i] = c;
-		else
-			break;
-	}
-
-	if (((*src)[i] == WINESC_REND_END) && (wmbc->buf->numrend < MAX_WINMSG_REND)) {
-		r = 0;
-		rbuf[i] = '\0';
-		if (i != 1 || rbuf[0] != WINESC_REND_POP)
-			r = ParseAttrColor(rbuf, 0);
-		AddWinMsgRend(wmbc->buf, wmbc->p, r);
-	}
-	*src += i;
+	AddWinMsgRend(wmbc->buf, wmbc->p, r);
 }
 
 winmsg_esc(SessName)
@@ -543,6 +553,151 @@ static void _MakeWinMsgEvRec(WinMsgBufContext *wmbc, WinMsgCond *cond, char *str
 	wmb_free(tmp);
 }
 
+static void WinMsgDep(WinMsgProg *prog, char c)
+{
+	prog->deps[(c >> 6) & 1] |= (uint64_t)1 << (c & 63);
+}
+
+static bool WinMsgUses(WinMsgProg *prog, char c)
+{
+	return (prog->deps[(c >> 6) & 1] >> (c & 63)) & 1;
+}
+
+static WinMsgOp *WinMsgAddOp(WinMsgProg *prog, int *maxops)
+{
+	if (prog->nops == *maxops) {
+		*maxops = *maxops ? *maxops * 2 : 8;
+		prog->ops = realloc(prog->ops, *maxops * sizeof(WinMsgOp));
+		if (prog->ops == NULL)
+			Panic(0, "%s", strnomem);
+	}
+	memset(&prog->ops[prog->nops], 0, sizeof(WinMsgOp));
+	return &prog->ops[prog->nops++];
+}
+
+static WinMsgProg *WinMsgCompile(const char *str, int chesc)
+{
+	WinMsgProg *prog;
+	WinMsgOp *op = NULL;
+	int maxops = 0;
+	char *t;
+
+	if ((prog = calloc(1, sizeof(WinMsgProg))) == NULL
+	    || (prog->src = SaveStr(str)) == NULL
+	    || (prog->text = malloc(strlen(str) + 1)) == NULL)
+		Panic(0, "%s", strnomem);
+	prog->chesc = chesc;
+
+	t = prog->text;
+	for (char *s = prog->src; *s; s++) {
+		if (*s != chesc) {
+			char c = *s;
+
+			if ((chesc == '%') && (c == '^')) {
+				if (!*++s)
+					break;
+				if (*s == '^' || *s < 64)
+					continue;
+				c = *s & 0x1f;
+			}
+			if (op == NULL || op->type != 0) {
+				op = WinMsgAddOp(prog, &maxops);
+				op->s = t;
+			}
+			*t++ = c;
+			op->len++;
+			continue;
+		}
+
+		if (*++s == chesc)	/* double escape ? */
+			continue;
+
+		op = WinMsgAddOp(prog, &maxops);
+		if ((op->esc.flags.plus = (*s == '+')) != 0)
+			s++;
+		if ((op->esc.flags.minus = (*s == '-')) != 0)
+			s++;
+		if ((op->esc.flags.zero = (*s == '0')) != 0)
+			s++;
+		while (*s >= '0' && *s <= '9')
+			op->esc.num = op->esc.num * 10 + (*s++ - '0');
+		if ((op->esc.flags.lng = (*s == 'L')) != 0)
+			s++;
+		if (!*s) {
+			prog->nops--;
+			break;
+		}
+		op->type = *s;
+		op->s = s;
+		WinMsgDep(prog, *s);
+
+		if (*s == WINESC_REND_START) {
+			char rbuf[RENDBUF_SIZE];
+			uint8_t i;
+
+			for (i = 0; i < (RENDBUF_SIZE-1); i++) {
+				char c = s[1 + i];
+				if (c && c != WINESC_REND_END)
+					rbuf[i] = c;
+				else
+					break;
+			}
+			s += 1 + i;
+			if (*s == WINESC_REND_END) {
+				rbuf[i] = '\0';
+				if (i != 1 || rbuf[0] != WINESC_REND_POP)
+					op->rend = ParseAttrColor(rbuf, 0);
+			} else {
+				prog->nops--;	/* unterminated; ignored */
+				op = NULL;
+			}
+			if (!*s)
+				break;
+		}
+	}
+	return prog;
+}
+
+static void WinMsgFree(WinMsgProg *prog)
+{
+	free(prog->src);
+	free(prog->text);
+	free(prog->ops);
+	free(prog);
+}
+
+/*
+ * Returns STR compiled for escape character CHESC, from the cache if it has
+ * been seen before. Recently used messages are kept at the front; the
+ * oldest one not being expanded is dropped once the cache is full.
+ */
+static WinMsgProg *WinMsgGet(const char *str, int chesc)
+{
+	WinMsgProg **pp, **victim = NULL;
+	WinMsgProg *prog;
+	int n = 0;
+
+	for (pp = &winmsg_progs; (prog = *pp); pp = &prog->next, n++) {
+		if (prog->chesc == chesc && !strcmp(prog->src, str)) {
+			*pp = prog->next;
+			prog->next = winmsg_progs;
+			winmsg_progs = prog;
+			return prog;
+		}
+		if (!prog->busy)
+			victim = pp;
+	}
+	if (n >= WINMSG_CACHE && victim) {
+		prog = *victim;
+		*victim = prog->next;
+		WinMsgFree(prog);
+	}
+	prog = WinMsgCompile(str, chesc);
+	prog->next = winmsg_progs;
+	winmsg_progs = prog;
+	return prog;
+}
+
 /* TODO: const char *str for safety and reassurance */
 char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
                    int chesc, int padlen, Event *ev, int rec)
@@ -553,8 +708,9 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 	int numpad = 0;
 	int lastpad = 0;
 	WinMsgBufContext *wmbc;
+	WinMsgProg *prog;
 	WinMsgEsc esc;
-	WinMsgCond *cond;
+	WinMsgCond cond;
 
 	/* TODO: temporary to work into existing code */
 	if (winmsg == NULL) {
@@ -568,12 +724,8 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 	if (rec > WINMSG_RECLIMIT)
 		return winmsg->buf;
 
-	cond = calloc(1, sizeof(WinMsgCond));
-	if (cond == NULL)
-		Panic(0, "%s", strnomem);
-
 	/* set to sane state (clear garbage) */
-	wmc_deinit(cond);
+	wmc_deinit(&cond);
 
 	/* TODO: we can get rid of this once winmsg is properly handled by caller */
 	if (winmsg->numrend > 0)
@@ -587,35 +739,21 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 
 	tick = 0;
 	gettimeofday(&now, NULL);
-	for (char *s = str; *s; s++) {
-		if (*s != chesc) {
-			if ((chesc == '%') && (*s == '^')) {
-				s++;
-				if (*s != '^' && *s >= 64)
-					wmbc_putchar(wmbc, *s & 0x1f);
-				continue;
-			}
-			wmbc_putchar(wmbc, *s);
+	prog = WinMsgGet(str, chesc);
+	prog->busy++;
+	for (WinMsgOp *op = prog->ops; op < prog->ops + prog->nops; op++) {
+		char *s = op->s;
+
+		if (op->type == 0) {
+			for (size_t i = 0; i < op->len; i++)
+				wmbc_putchar(wmbc, s[i]);
 			continue;
 		}
 
-		if (*++s == chesc)	/* double escape ? */
-			continue;
-
-		/* initialize escape */
-		if ((esc.flags.plus = (*s == '+')) != 0)
-			s++;
-		if ((esc.flags.minus = (*s == '-')) != 0)
-			s++;
-		if ((esc.flags.zero = (*s == '0')) != 0)
-			s++;
-		esc.num = 0;
-		while (*s >= '0' && *s <= '9')
-			esc.num = esc.num * 10 + (*s++ - '0');
-		if ((esc.flags.lng = (*s == 'L')) != 0)
-			s++;
+		/* handlers may change their copy of the escape */
+		esc = op->esc;
 
-		switch (*s) {
+		switch (op->type) {
 		case WINESC_COND:
 			WinMsgDoEscEx(Cond, &qmnumrend);
 			break;
@@ -646,7 +784,7 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 			WinMsgDoEscEx(WinGroup, win);
 			break;
 		case WINESC_REND_START:
-			WinMsgDoEsc(Rend);
+			WinMsgDoEscEx(Rend, op->rend);
 			break;
 		case WINESC_HOST:
 			WinMsgDoEsc(HostName);
@@ -692,8 +830,9 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 			break;
 		}
 	}
-	if (wmc_is_active(cond) && !wmc_is_set(cond))
-		wmbc->p = wmbc->buf->buf + wmc_end(cond, wmbc_offset(wmbc), NULL) + 1;
+	prog->busy--;
+	if (wmc_is_active(&cond) && !wmc_is_set(&cond))
+		wmbc->p = wmbc->buf->buf + wmc_end(&cond, wmbc_offset(wmbc), NULL) + 1;
 	wmbc_putchar(wmbc, '\0' );
 	wmbc->p--; /* TODO: temporary to work with old code */
 	if (numpad) {
@@ -706,15 +845,11 @@ char *MakeWinMsgEv(WinMsgBuf *winmsg, char *str, Window *win,
 		ev->timeout = 0;
 	}
 	if (ev && tick) {
-		now.tv_usec = 100000;
-		if (tick == 1)
-			now.tv_sec++;
-		else
-			now.tv_sec += tick - (now.tv_sec % tick);
-		ev->timeout = (now.tv_sec * 1000 + now.tv_usec / 1000);
+		/* next update is aligned to the wall clock, 100ms past the tick */
+		time_t next = now.tv_sec + (tick == 1 ? 1 : tick - (now.tv_sec % tick));
+		SetTimeout(ev, (next - now.tv_sec) * 1000 + (100000 - now.tv_usec) / 1000);
 	}
 
-	free(cond);
 	wmbc_free(wmbc);
 	return winmsg->buf;
 }
@@ -724,32 +859,14 @@ char *MakeWinMsg(char *s, Window *win, int esc)
 	return MakeWinMsgEv(NULL, s, win, esc, 0, NULL, 0);
 }
 
+/* Does message S (or, for HP == NULL, a hardstatus) use escape WHAT? */
 static int WindowChangedCheck(char *s, WinMsgEscapeChar what, int *hp)
 {
-	int h = 0;
-	int l;
-	while (*s) {
-		if (*s++ != (hp ? '%' : '\005'))
-			continue;
-		l = 0;
-		s += (*s == '+');
-		s += (*s == '-');
-		while (*s >= '0' && *s <= '9')
-			s++;
-		if (*s == 'L') {
-			s++;
-			l = 0x100;
-		}
-		if (*s == WINESC_HSTATUS)
-			h = 1;
-		if (*s == (char)what || ((*s | l) == (int)what))
-			break;
-		if (*s)
-			s++;
-	}
+	WinMsgProg *prog = WinMsgGet(s, hp ? '%' : WINMSG_BT_ESC);
+
 	if (hp)
-		*hp = h;
-	return *s ? 1 : 0;
+		*hp = WinMsgUses(prog, WINESC_HSTATUS);
+	return WinMsgUses(prog, (char)what);
 }
 
 void WindowChanged(Window *win, WinMsgEscapeChar what)